@@ -0,0 +1,386 @@
+/* mwm bench - scan and arrange costs against a simulated window server
+ *
+ * Builds mwm.c with a mock Backend: n windows spread over apps with
+ * five windows each, every AX call counted and optionally delayed,
+ * so it runs without Accessibility permission or real windows.
+ * Elements are CFNumbers, window ids for windows and negative pids
+ * for apps, so CFEqual/CFRetain in mwm.c behave as with real ones.
+ * Exits non-zero when an operation writes more than it has to.
+ *
+ * usage: mwm-bench [-l usec] nwindows...
+ */
+
+#define main mwmmain
+#include "mwm.c"
+#undef main
+
+#include <sys/wait.h>
+
+#define PIDBASE     1000
+#define APPWINDOWS  5       /* windows per simulated app */
+#define FOCUSWRITES 3       /* main, focused and frontmost */
+
+typedef struct {
+    CGRect frame;
+    pid_t pid;
+} MockWin;
+
+typedef struct {
+    uint64_t start;
+    uint64_t reads;
+    uint64_t writes;
+} Sample;
+
+static MockWin *mockwins;
+static int nmockwins;
+static CFArrayRef *appwindows;  /* per app, its window elements */
+static CFArrayRef windowlist;
+static unsigned int latency = 0;  /* usec per AX call */
+static _Atomic uint64_t axreads, axwrites;
+static int regressed;
+
+static void
+mockdelay(void) {
+    uint64_t t;
+
+    /* spin, usleep is far too coarse for the latencies of interest */
+    if (!latency)
+        return;
+    t = metrics_now();
+    while (metrics_now() - t < latency * 1000ULL);
+}
+
+static int
+mockid(AXUIElementRef el) {
+    int id = 0;
+
+    CFNumberGetValue((CFNumberRef)el, kCFNumberIntType, &id);
+    return id;
+}
+
+static AXUIElementRef
+mockelement(int id) {
+    return (AXUIElementRef)CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &id);
+}
+
+static AXError
+mockcopyattr(AXUIElementRef el, CFStringRef attr, CFTypeRef *value) {
+    int id = mockid(el);
+    MockWin *w;
+
+    atomic_fetch_add_explicit(&axreads, 1, memory_order_relaxed);
+    mockdelay();
+
+    if (id < 0) {
+        CFArrayRef wins = appwindows[-id - PIDBASE];
+
+        if (CFEqual(attr, kAXWindowsAttribute)) {
+            *value = CFRetain(wins);
+            return kAXErrorSuccess;
+        }
+        if (CFEqual(attr, kAXFocusedWindowAttribute) && CFArrayGetCount(wins)) {
+            *value = CFRetain(CFArrayGetValueAtIndex(wins, 0));
+            return kAXErrorSuccess;
+        }
+        return kAXErrorAttributeUnsupported;
+    }
+
+    if (id < 1 || id > nmockwins)
+        return kAXErrorInvalidUIElement;
+    w = &mockwins[id - 1];
+    if (CFEqual(attr, kAXPositionAttribute))
+        *value = AXValueCreate(kAXValueCGPointType, &w->frame.origin);
+    else if (CFEqual(attr, kAXSizeAttribute))
+        *value = AXValueCreate(kAXValueCGSizeType, &w->frame.size);
+    else if (CFEqual(attr, kAXMinimizedAttribute))
+        *value = CFRetain(kCFBooleanFalse);
+    else if (CFEqual(attr, kAXSubroleAttribute))
+        *value = CFRetain(kAXStandardWindowSubrole);
+    else if (CFEqual(attr, kAXTitleAttribute))
+        *value = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("Window %d"), id);
+    else
+        return kAXErrorAttributeUnsupported;
+    return kAXErrorSuccess;
+}
+
+static AXError
+mocksetattr(AXUIElementRef el, CFStringRef attr, CFTypeRef value) {
+    int id = mockid(el);
+
+    atomic_fetch_add_explicit(&axwrites, 1, memory_order_relaxed);
+    mockdelay();
+
+    /* a window is only ever written from its app's lane */
+    if (id < 1 || id > nmockwins)
+        return kAXErrorSuccess;
+    if (CFEqual(attr, kAXPositionAttribute))
+        AXValueGetValue(value, kAXValueCGPointType, &mockwins[id - 1].frame.origin);
+    else if (CFEqual(attr, kAXSizeAttribute))
+        AXValueGetValue(value, kAXValueCGSizeType, &mockwins[id - 1].frame.size);
+    return kAXErrorSuccess;
+}
+
+static AXError
+mockaction(AXUIElementRef el, CFStringRef action) {
+    atomic_fetch_add_explicit(&axwrites, 1, memory_order_relaxed);
+    mockdelay();
+    return kAXErrorSuccess;
+}
+
+static AXError
+mocksettimeout(AXUIElementRef el, float seconds) {
+    return kAXErrorSuccess;  /* local to the client, no IPC */
+}
+
+static AXError
+mockgetwindow(AXUIElementRef el, CGWindowID *wid) {
+    int id = mockid(el);
+
+    if (id < 1)
+        return kAXErrorInvalidUIElement;
+    *wid = (CGWindowID)id;
+    return kAXErrorSuccess;
+}
+
+static AXUIElementRef
+mockcreateapp(pid_t pid) {
+    return mockelement(-(int)pid);
+}
+
+static AXError
+mockcreateobserver(pid_t pid, AXObserverCallback cb, AXObserverRef *obs) {
+    return kAXErrorNotImplemented;  /* changes are found by scan() */
+}
+
+static CFArrayRef
+mockwindowlist(void) {
+    atomic_fetch_add_explicit(&axreads, 1, memory_order_relaxed);
+    mockdelay();
+    return CFRetain(windowlist);
+}
+
+static int
+mockappinfo(pid_t pid, char *name, size_t namesz, char *bundle, size_t bundlesz) {
+    snprintf(name, namesz, "App %d", (int)pid - PIDBASE);
+    snprintf(bundle, bundlesz, "bench.app%d", (int)pid - PIDBASE);
+    return 1;
+}
+
+static const Backend mockbackend = {
+    .copyattr = mockcopyattr,
+    .setattr = mocksetattr,
+    .action = mockaction,
+    .settimeout = mocksettimeout,
+    .getwindow = mockgetwindow,
+    .createapp = mockcreateapp,
+    .createobserver = mockcreateobserver,
+    .windowlist = mockwindowlist,
+    .appinfo = mockappinfo,
+};
+
+static void
+mocksetup(int n) {
+    int napps = (n + APPWINDOWS - 1) / APPWINDOWS, layer = 0;
+    CFMutableArrayRef list = CFArrayCreateMutable(kCFAllocatorDefault, n, &kCFTypeArrayCallBacks);
+
+    nmockwins = n;
+    mockwins = calloc(n, sizeof(MockWin));
+    appwindows = calloc(napps, sizeof(CFArrayRef));
+    if (!mockwins || !appwindows)
+        die("mwm-bench: cannot allocate memory\n");
+
+    for (int a = 0; a < napps; a++) {
+        CFMutableArrayRef wins = CFArrayCreateMutable(kCFAllocatorDefault, APPWINDOWS,
+                                                      &kCFTypeArrayCallBacks);
+
+        for (int id = a * APPWINDOWS + 1; id <= MIN(n, (a + 1) * APPWINDOWS); id++) {
+            AXUIElementRef el = mockelement(id);
+            pid_t pid = PIDBASE + a;
+            CFNumberRef pidref = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &pid);
+            CFNumberRef layerref = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &layer);
+            const void *keys[] = { kCGWindowOwnerPID, kCGWindowLayer };
+            const void *values[] = { pidref, layerref };
+            CFDictionaryRef info = CFDictionaryCreate(kCFAllocatorDefault, keys, values, 2,
+                                                      &kCFTypeDictionaryKeyCallBacks,
+                                                      &kCFTypeDictionaryValueCallBacks);
+
+            mockwins[id - 1].pid = pid;
+            mockwins[id - 1].frame = CGRectMake(100 + id % 50, 100 + id % 30, 800, 600);
+            CFArrayAppendValue(wins, el);
+            CFArrayAppendValue(list, info);
+            CFRelease(info);
+            CFRelease(layerref);
+            CFRelease(pidref);
+            CFRelease(el);
+        }
+        appwindows[a] = wins;
+    }
+    windowlist = list;
+}
+
+static void
+benchsetup(int n) {
+    CFRunLoopSourceContext ctx = { .perform = runcommands };
+
+    mocksetup(n);
+    backend = &mockbackend;
+
+    /* one 1440x900 display, as setupmonitors() would see it */
+    nmonitors = 1;
+    monitors = calloc(1, sizeof(Monitor));
+    if (!monitors)
+        die("mwm-bench: cannot allocate memory\n");
+    monitors[0].id = 1;
+    monitors[0].rect = CGRectMake(0, 25, 1440, 875);
+    monitors[0].pertag = newpertag();
+    assigntags();
+    selmon = &monitors[0];
+
+    compilerules();
+
+    /* requestarrange() signals it, runcommands() is called directly */
+    cmdsrc = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &ctx);
+}
+
+static void
+settle(void) {
+    /* count the whole apply, not just the bounded wait in flushframes() */
+    if (applygroup)
+        dispatch_group_wait(applygroup, DISPATCH_TIME_FOREVER);
+}
+
+static void
+begin(Sample *s) {
+    s->reads = atomic_load(&axreads);
+    s->writes = atomic_load(&axwrites);
+    s->start = metrics_now();
+}
+
+static double
+end(Sample *s, int n, const char *name, int iters) {
+    double ms = (metrics_now() - s->start) / 1e6 / iters;
+    double writes = (double)(atomic_load(&axwrites) - s->writes) / iters;
+
+    printf("%6d %-20s %10.3f %10.1f %10.1f\n", n, name, ms,
+           (double)(atomic_load(&axreads) - s->reads) / iters, writes);
+    fflush(stdout);
+    return writes;
+}
+
+static void
+atmost(int n, const char *name, double writes, double max) {
+    /* the write counts are exact, any excess is a regression */
+    if (writes <= max)
+        return;
+    fprintf(stderr, "mwm-bench: %d %s: %.1f ax writes per op, at most %.1f expected\n",
+            n, name, writes, max);
+    regressed = 1;
+}
+
+static int
+bench(int n) {
+    const int iters = 20;
+    Sample s;
+    Arg arg;
+    int i, changed;
+
+    benchsetup(n);
+
+    begin(&s);
+    scan();
+    end(&s, n, "scan (manage all)", 1);
+
+    begin(&s);
+    runcommands(NULL);
+    settle();
+    end(&s, n, "arrange (first)", 1);
+
+    begin(&s);
+    for (i = 0; i < iters; i++)
+        scan();
+    atmost(n, "scan (no change)", end(&s, n, "scan (no change)", iters), 0);
+
+    begin(&s);
+    for (i = 0; i < iters; i++) {
+        requestarrange();
+        runcommands(NULL);
+        settle();
+    }
+    atmost(n, "arrange (no change)", end(&s, n, "arrange (no change)", iters), 0);
+
+    /* half the windows to tag 2, then switch back and forth */
+    i = 0;
+    for (Client *c = clients; c; c = c->next)
+        settags(c, 1 << (i++ & 1));
+    requestarrange();
+    runcommands(NULL);
+    settle();
+
+    /* a window that flips costs a move, and a resize when shown */
+    changed = 0;
+    begin(&s);
+    for (i = 0; i < iters; i++) {
+        arg.ui = 1 << ((i + 1) & 1);
+        for (Client *c = clients; c; c = c->next)
+            changed += !ISVISIBLE(c) != !(c->tags & arg.ui);
+        view(&arg);
+        runcommands(NULL);
+        settle();
+    }
+    atmost(n, "view (tag switch)", end(&s, n, "view (tag switch)", iters),
+           (2.0 * changed) / iters + FOCUSWRITES);
+
+    begin(&s);
+    for (i = 0; i < iters; i++) {
+        arg.f = i & 1 ? -0.05 : 0.05;
+        setmfact(&arg);
+        runcommands(NULL);
+        settle();
+    }
+    end(&s, n, "setmfact", iters);
+
+    begin(&s);
+    for (i = 0; i < iters; i++) {
+        swapnext(&arg);
+        runcommands(NULL);
+        settle();
+    }
+    end(&s, n, "swapnext", iters);
+
+    begin(&s);
+    for (i = 0; i < iters; i++) {
+        focusnext(&arg);
+        runcommands(NULL);
+        settle();
+    }
+    end(&s, n, "focusnext", iters);
+    return regressed;
+}
+
+int
+main(int argc, char *argv[]) {
+    int i = 1, status, failed = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "-l")) {
+        latency = (unsigned int)atoi(argv[2]);
+        i = 3;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "usage: mwm-bench [-l usec] nwindows...\n");
+        return 1;
+    }
+
+    printf("%6s %-20s %10s %10s %10s   (per op, %u us per AX call)\n",
+           "wins", "operation", "ms", "ax reads", "ax writes", latency);
+
+    /* every size in a fresh process, mwm keeps its state in globals */
+    for (; i < argc; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0)
+            exit(bench(atoi(argv[i])));
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            failed = 1;
+    }
+    return failed;
+}
@@ -9,13 +9,43 @@
 // #define DEBUG 1
 
 /* appearance */
+/* layout, mfact, nmaster and gap are kept per monitor and tag,
+ * these are the starting values */
 #define DEFAULT_MFACT   0.55f  /* master area size [0.05..0.95] */
 #define DEFAULT_NMASTER 1      /* number of clients in master area */
 static const unsigned int gappx = 10;    /* gap pixel between windows */
 static const unsigned int borderpx = 2;  /* border pixel (visual only) */
 
+/* window tracking */
+static const double scanmin = 0.1;       /* rescan interval in seconds while windows are changing */
+static const double scanmax = 5.0;       /* idle safety-net ceiling, changes arrive via AXObserver */
+static const double scanfast = 2.0;      /* seconds of fast rescans after a spawn, launch or close */
+static const float axtimeout = 0.5f;     /* seconds an unresponsive app may block one AX call */
+static const unsigned int applywait = 250;  /* ms arrange() waits for all apps to apply frames */
+
+/* how windows on hidden tags are parked:
+ * HideOffscreen = move off screen
+ * HideMinimize  = minimize to the Dock
+ * HideApp       = hide the whole app when none of its windows is visible,
+ *                 move the rest off screen */
+static const int hidemode = HideOffscreen;
+
 /* apps */
 static const char *termcmd[] = { "/Applications/Ghostty.app", NULL };
+static const char *scratchtermcmd[] = { "/Applications/Ghostty.app/Contents/MacOS/ghostty",
+                                        "--title=scratchpad", NULL };
+static const char *notescmd[] = { "/System/Applications/Notes.app", NULL };
+
+/* scratchpads: windows kept managed but hidden, togglescratch shows one
+ * floating on the current monitor and hides it again. On the first toggle
+ * the first window matching app (substring or bundle id) and title
+ * (substring, NULL = any) becomes the scratchpad, command starts one if
+ * none exists. Until then matching windows are tiled as usual. */
+static const Scratchpad scratchpads[] = {
+    /* app                  title           command         x     y     w     h */
+    { "Ghostty",            "scratchpad",   scratchtermcmd, 0.15, 0.10, 0.70, 0.60 },
+    { "com.apple.Notes",    NULL,           notescmd,       0.55, 0.05, 0.40, 0.85 },
+};
 
 /*
  * Modifier key:
@@ -69,27 +99,45 @@ static const char *termcmd[] = { "/Applications/Ghostty.app", NULL };
 #define Key_0       0x1D
 #define Key_Comma   0x2B
 #define Key_Period  0x2F
+#define Key_Grave   0x32
+#define Key_Minus   0x1B
+#define Key_Equal   0x18
+#define Key_Left    0x7B
+#define Key_Right   0x7C
+#define Key_Down    0x7D
+#define Key_Up      0x7E
 
 /* tags/workspaces */
 static const char *tags[] = { "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
-/* rules: app name, tag mask (0 = current), floating */
+/* display owning each tag: 0 = main, then left to right. Tags of
+ * displays that are not connected go to the last one, a display left
+ * without any takes the last tag of the display with the most. */
+static const int tagmon[] = { 0, 0, 0, 0, 0, 1, 1, 1, 1 };
+
+/* rules: app name (substring) or bundle id (exact), window title (substring),
+ * tag mask (0 = current), floating. NULL app or title matches anything. */
 static const Rule rules[] = {
-    /* app                          tag     floating */
-    { "System Preferences",         0,      1 },
-    { "System Settings",            0,      1 },
-    { "Calculator",                 0,      1 },
-    { "Preview",                    0,      1 },
+    /* app                          title   tag     floating */
+    { "System Preferences",         NULL,   0,      1 },
+    { "System Settings",            NULL,   0,      1 },
+    { "Calculator",                 NULL,   0,      1 },
+    { "Preview",                    NULL,   0,      1 },
 };
 
 /* layouts */
-enum { LayoutTile, LayoutMonocle, LayoutFloat, LayoutLast };
+enum { LayoutTile, LayoutMonocle, LayoutBstack, LayoutGrid,
+       LayoutDwindle, LayoutCentered, LayoutFloat, LayoutLast };
 
 static const Layout layouts[] = {
-    /* symbol   arrange function */
-    { "[]=",    tile },     /* tiled (default) */
-    { "[M]",    monocle },  /* monocle */
-    { "><>",    NULL },     /* floating */
+    /* symbol   arrange function (see layout.h) */
+    { "[]=",    tile },             /* tiled (default) */
+    { "[M]",    monocle },          /* monocle */
+    { "TTT",    bstack },           /* master on top, stack below */
+    { "###",    grid },             /* equal cells */
+    { "[\\]",   dwindle },          /* each window halves the rest */
+    { "|M|",    centeredmaster },   /* master centered, stack on both sides */
+    { "><>",    NULL },             /* floating */
 };
 
 /* key bindings */
@@ -100,19 +148,38 @@ static Key keys[] = {
     { MODKEY,           Key_K,      focusprev,      {0} },
     { MODKEY|ShiftMask, Key_J,      swapnext,       {0} },
     { MODKEY|ShiftMask, Key_K,      swapprev,       {0} },
+    { MODKEY|ShiftMask, Key_Return, zoom,           {0} },
     { MODKEY,           Key_H,      setmfact,       {.f = -0.05} },
     { MODKEY,           Key_L,      setmfact,       {.f = +0.05} },
     { MODKEY,           Key_I,      incnmaster,     {.i = +1} },
     { MODKEY,           Key_D,      incnmaster,     {.i = -1} },
+    { MODKEY,           Key_Minus,  setgap,         {.i = -5} },
+    { MODKEY,           Key_Equal,  setgap,         {.i = +5} },
+    { MODKEY|ShiftMask, Key_Equal,  setgap,         {.i = 0} },
     { MODKEY|ShiftMask, Key_C,      killclient,     {0} },
     { MODKEY,           Key_T,      setlayout,      {.i = LayoutTile} },
     { MODKEY,           Key_M,      setlayout,      {.i = LayoutMonocle} },
     { MODKEY,           Key_F,      setlayout,      {.i = LayoutFloat} },
+    { MODKEY,           Key_U,      setlayout,      {.i = LayoutBstack} },
+    { MODKEY,           Key_G,      setlayout,      {.i = LayoutGrid} },
+    { MODKEY,           Key_R,      setlayout,      {.i = LayoutDwindle} },
+    { MODKEY,           Key_O,      setlayout,      {.i = LayoutCentered} },
     { MODKEY,           Key_Space,  cyclelayout,    {0} },
     { MODKEY|ShiftMask, Key_Space,  togglefloat,    {0} },
+    { MODKEY,           Key_S,      togglesticky,   {0} },
     { MODKEY,           Key_Tab,    focuslast,      {0} },
+    { MODKEY,           Key_Grave,  togglescratch,  {.ui = 0} },
+    { MODKEY,           Key_N,      togglescratch,  {.ui = 1} },
     { MODKEY,           Key_Comma,  focusleftmon,   {0} },
     { MODKEY,           Key_Period, focusrightmon,  {0} },
+    { MODKEY,           Key_Left,   focusdir,       {.i = DirLeft} },
+    { MODKEY,           Key_Right,  focusdir,       {.i = DirRight} },
+    { MODKEY,           Key_Up,     focusdir,       {.i = DirUp} },
+    { MODKEY,           Key_Down,   focusdir,       {.i = DirDown} },
+    { MODKEY|ShiftMask, Key_Left,   swapdir,        {.i = DirLeft} },
+    { MODKEY|ShiftMask, Key_Right,  swapdir,        {.i = DirRight} },
+    { MODKEY|ShiftMask, Key_Up,     swapdir,        {.i = DirUp} },
+    { MODKEY|ShiftMask, Key_Down,   swapdir,        {.i = DirDown} },
     TAGKEYS(            Key_1,                      0)
     TAGKEYS(            Key_2,                      1)
     TAGKEYS(            Key_3,                      2)
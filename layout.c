@@ -0,0 +1,189 @@
+/* mwm layout - pure tiling layout functions
+ *
+ * Every layout works on the area inside the outer gap and splits it
+ * into columns and rows separated by the gap. Sizes are whole pixels,
+ * the last cell of a split takes the rounding remainder so the cells
+ * always fill their area exactly.
+ */
+
+#include <math.h>
+#include "layout.h"
+
+#ifndef MAX
+#define MAX(A, B)       ((A) > (B) ? (A) : (B))
+#endif
+#ifndef MIN
+#define MIN(A, B)       ((A) < (B) ? (A) : (B))
+#endif
+
+static CGRect
+inner(CGRect area, int gap) {
+    return CGRectMake(area.origin.x + gap, area.origin.y + gap,
+                      MAX(1, area.size.width - 2 * gap),
+                      MAX(1, area.size.height - 2 * gap));
+}
+
+/* i-th of n rows of r */
+static CGRect
+row(CGRect r, int gap, int n, int i) {
+    CGFloat h = floor((r.size.height - (n - 1) * gap) / n);
+    CGFloat y = r.origin.y + i * (h + gap);
+
+    if (i == n - 1)
+        h = r.origin.y + r.size.height - y;
+    return CGRectMake(r.origin.x, y, r.size.width, h);
+}
+
+/* i-th of n columns of r */
+static CGRect
+col(CGRect r, int gap, int n, int i) {
+    CGFloat w = floor((r.size.width - (n - 1) * gap) / n);
+    CGFloat x = r.origin.x + i * (w + gap);
+
+    if (i == n - 1)
+        w = r.origin.x + r.size.width - x;
+    return CGRectMake(x, r.origin.y, w, r.size.height);
+}
+
+/* cut a part of size s off the left (vertical) or top of r */
+static CGRect
+cut(CGRect *r, int gap, CGFloat s, int vertical) {
+    CGRect a = *r;
+
+    if (vertical) {
+        a.size.width = s;
+        r->origin.x += s + gap;
+        r->size.width -= s + gap;
+    } else {
+        a.size.height = s;
+        r->origin.y += s + gap;
+        r->size.height -= s + gap;
+    }
+    return a;
+}
+
+void
+tile(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap), m;
+    int nm = MIN(p->nmaster, n);
+
+    if (n <= 0)
+        return;
+
+    /* only one column: everything in master, or no master at all */
+    if (nm == 0 || nm == n) {
+        for (int i = 0; i < n; i++)
+            out[i] = row(r, p->gap, n, i);
+        return;
+    }
+
+    m = cut(&r, p->gap, floor((r.size.width - p->gap) * p->mfact), 1);
+    for (int i = 0; i < nm; i++)
+        out[i] = row(m, p->gap, nm, i);
+    for (int i = nm; i < n; i++)
+        out[i] = row(r, p->gap, n - nm, i - nm);
+}
+
+void
+monocle(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap);
+
+    for (int i = 0; i < n; i++)
+        out[i] = r;
+}
+
+void
+bstack(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap), m;
+    int nm = MIN(p->nmaster, n);
+
+    if (n <= 0)
+        return;
+
+    /* the master row on top, the stack side by side below it */
+    if (nm == 0 || nm == n) {
+        for (int i = 0; i < n; i++)
+            out[i] = col(r, p->gap, n, i);
+        return;
+    }
+
+    m = cut(&r, p->gap, floor((r.size.height - p->gap) * p->mfact), 0);
+    for (int i = 0; i < nm; i++)
+        out[i] = col(m, p->gap, nm, i);
+    for (int i = nm; i < n; i++)
+        out[i] = col(r, p->gap, n - nm, i - nm);
+}
+
+void
+grid(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap);
+    int cols, i = 0;
+
+    if (n <= 0)
+        return;
+
+    /* near square grid, the rightmost columns take the extra rows */
+    for (cols = 1; cols * cols < n; cols++);
+    for (int c = 0; c < cols; c++) {
+        CGRect column = col(r, p->gap, cols, c);
+        int rows = n / cols + (c >= cols - n % cols ? 1 : 0);
+
+        for (int k = 0; k < rows; k++)
+            out[i++] = row(column, p->gap, rows, k);
+    }
+}
+
+void
+dwindle(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap);
+
+    /* each client takes a part of what is left, alternating between
+     * splitting left/right and top/bottom; the first split uses mfact */
+    for (int i = 0; i < n; i++) {
+        int vertical = !(i & 1);
+        CGFloat len = vertical ? r.size.width : r.size.height;
+        float f = i == 0 ? p->mfact : 0.5f;
+
+        if (i == n - 1) {
+            out[i] = r;
+            break;
+        }
+        out[i] = cut(&r, p->gap, floor((len - p->gap) * f), vertical);
+    }
+}
+
+void
+centeredmaster(CGRect area, const LayoutParams *p, int n, CGRect *out) {
+    CGRect r = inner(area, p->gap), left, right, m = r;
+    int nm = MIN(p->nmaster, n), ns = n - nm, nl, nr;
+    CGFloat mw, sw;
+
+    if (n <= 0)
+        return;
+
+    /* without a stack to put beside it the master is just tiled */
+    if (ns <= 1) {
+        tile(area, p, n, out);
+        return;
+    }
+
+    /* master in the middle, the stack alternating right and left */
+    mw = nm ? floor((r.size.width - 2 * p->gap) * p->mfact) : 0;
+    sw = floor((r.size.width - mw - (nm ? 2 : 1) * p->gap) / 2);
+    left = cut(&r, p->gap, sw, 1);
+    if (nm)
+        m = cut(&r, p->gap, mw, 1);
+    right = r;
+
+    for (int i = 0; i < nm; i++)
+        out[i] = row(m, p->gap, nm, i);
+
+    nr = (ns + 1) / 2;
+    nl = ns / 2;
+    for (int k = 0; k < ns; k++) {
+        if (k & 1)
+            out[nm + k] = row(left, p->gap, nl, k / 2);
+        else
+            out[nm + k] = row(right, p->gap, nr, k / 2);
+    }
+}
@@ -0,0 +1,28 @@
+/* mwm layout - pure tiling layout functions */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <ApplicationServices/ApplicationServices.h>
+
+/* Parameters of the tag view being laid out */
+typedef struct {
+    float mfact;    /* master area fraction [0.1..0.9] */
+    int nmaster;    /* clients in the master area, may be 0 */
+    int gap;        /* pixels around and between windows */
+} LayoutParams;
+
+/* A layout maps the usable area and n tiled clients, in client list
+ * order, to n frames in out[]. It only computes geometry: no globals,
+ * no window system calls, so layouts can be run and checked offline.
+ */
+typedef void (*LayoutFunc)(CGRect area, const LayoutParams *p, int n, CGRect *out);
+
+void tile(CGRect area, const LayoutParams *p, int n, CGRect *out);
+void monocle(CGRect area, const LayoutParams *p, int n, CGRect *out);
+void bstack(CGRect area, const LayoutParams *p, int n, CGRect *out);
+void grid(CGRect area, const LayoutParams *p, int n, CGRect *out);
+void dwindle(CGRect area, const LayoutParams *p, int n, CGRect *out);
+void centeredmaster(CGRect area, const LayoutParams *p, int n, CGRect *out);
+
+#endif /* LAYOUT_H */
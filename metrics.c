@@ -0,0 +1,127 @@
+/* mwm metrics - low overhead latency histograms
+ *
+ * HDR style log-linear buckets: every power of two of microseconds is
+ * split into four, so quantiles are within 25% at any scale while a
+ * histogram stays a fixed 1KB array. Recording is a handful of relaxed
+ * atomic adds, cheap enough to leave on around every AX call.
+ */
+
+#include <mach/mach_time.h>
+#include "metrics.h"
+
+#define PIDSTATSIZE 128  /* power of two */
+
+typedef struct {
+    _Atomic pid_t pid;
+    Histogram hist;
+} PidStat;
+
+static PidStat pidstats[PIDSTATSIZE];
+static Histogram pidoverflow;
+
+uint64_t
+metrics_now(void) {
+    static mach_timebase_info_data_t tb;
+
+    if (!tb.denom)
+        mach_timebase_info(&tb);
+    return mach_absolute_time() * tb.numer / tb.denom;
+}
+
+static unsigned int
+bucketindex(uint64_t us) {
+    unsigned int e, idx;
+
+    if (us < 4)
+        return (unsigned int)us;
+    e = 63 - __builtin_clzll(us);
+    idx = (e - 1) * 4 + ((us >> (e - 2)) & 3);
+    return idx < HISTBUCKETS ? idx : HISTBUCKETS - 1;
+}
+
+/* largest value that falls into bucket idx */
+static uint64_t
+bucketmax(unsigned int idx) {
+    unsigned int e, sub;
+
+    if (idx < 4)
+        return idx;
+    idx++;
+    e = idx / 4 + 1;
+    sub = idx % 4;
+    return ((uint64_t)(4 + sub) << (e - 2)) - 1;
+}
+
+void
+hist_add(Histogram *h, uint64_t start) {
+    uint64_t us = (metrics_now() - start) / 1000;
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->bucket[bucketindex(us)], 1, memory_order_relaxed);
+    while (us > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, us,
+                           memory_order_relaxed, memory_order_relaxed));
+}
+
+Histogram *
+metrics_pid(pid_t pid) {
+    unsigned int i = ((unsigned int)pid * 2654435761u) & (PIDSTATSIZE - 1);
+
+    /* open addressing, slots are claimed once and never freed so the
+     * numbers of exited apps are still there to look at */
+    for (unsigned int n = 0; n < PIDSTATSIZE; n++, i = (i + 1) & (PIDSTATSIZE - 1)) {
+        pid_t cur = atomic_load_explicit(&pidstats[i].pid, memory_order_acquire);
+        pid_t empty = 0;
+
+        if (cur == pid)
+            return &pidstats[i].hist;
+        if (!cur && atomic_compare_exchange_strong(&pidstats[i].pid, &empty, pid))
+            return &pidstats[i].hist;
+        if (empty == pid)
+            return &pidstats[i].hist;  /* another thread claimed it first */
+    }
+    return &pidoverflow;
+}
+
+static uint64_t
+quantile(Histogram *h, uint64_t count, double q) {
+    uint64_t want = (uint64_t)(count * q), seen = 0;
+
+    for (unsigned int i = 0; i < HISTBUCKETS; i++) {
+        seen += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+        if (seen > want)
+            return bucketmax(i);
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+void
+hist_print(FILE *f, const char *name, Histogram *h) {
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+
+    if (!count)
+        return;
+    fprintf(f, "%-28s %8llu %9llu %9llu %9llu %9llu %9llu\n", name,
+            (unsigned long long)count,
+            (unsigned long long)(atomic_load_explicit(&h->total, memory_order_relaxed) / count),
+            (unsigned long long)quantile(h, count, 0.50),
+            (unsigned long long)quantile(h, count, 0.90),
+            (unsigned long long)quantile(h, count, 0.99),
+            (unsigned long long)atomic_load_explicit(&h->max, memory_order_relaxed));
+}
+
+void
+metrics_printpids(FILE *f) {
+    char name[32];
+
+    for (unsigned int i = 0; i < PIDSTATSIZE; i++) {
+        pid_t pid = atomic_load_explicit(&pidstats[i].pid, memory_order_acquire);
+
+        if (!pid)
+            continue;
+        snprintf(name, sizeof(name), "ax pid %d", (int)pid);
+        hist_print(f, name, &pidstats[i].hist);
+    }
+    hist_print(f, "ax pid (other)", &pidoverflow);
+}
@@ -0,0 +1,40 @@
+/* mwm metrics - low overhead latency histograms */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define HISTBUCKETS 128  /* 4 sub-buckets per power of two, microseconds up to ~71 minutes */
+
+/* Latency histogram, safe to record into from any thread */
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t total;  /* microseconds */
+    _Atomic uint64_t max;
+    _Atomic uint64_t bucket[HISTBUCKETS];
+} Histogram;
+
+/* Monotonic timestamp in nanoseconds, start of a span */
+uint64_t metrics_now(void);
+
+/* Record the time since start (from metrics_now) */
+void hist_add(Histogram *h, uint64_t start);
+
+/* Histogram of a process, for per-app AX timings
+ * Returns a shared overflow histogram once the pid table is full
+ */
+Histogram *metrics_pid(pid_t pid);
+
+/* Print one line: name, count, mean, p50, p90, p99 and max in microseconds
+ * Empty histograms are skipped
+ */
+void hist_print(FILE *f, const char *name, Histogram *h);
+
+/* Print the per-pid histograms */
+void metrics_printpids(FILE *f);
+
+#endif /* METRICS_H */
@@ -8,6 +8,7 @@
 
 #include <ApplicationServices/ApplicationServices.h>
 #include <Carbon/Carbon.h>
+#include <dispatch/dispatch.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,17 +16,41 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
 #include <sys/file.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include "statusbar.h"
+#include "workspace.h"
+#include "layout.h"
+#include "metrics.h"
 #include "cJSON.h"
 
 /* PID file for single instance */
 #define PIDFILE "/tmp/mwm.pid"
 static int pidfd = -1;
 
+/* Control socket, see ipcexec() */
+#define SOCKFILE "/tmp/mwm.sock"
+#define IPCMAXQUEUE (4 << 20)  /* bytes a reader may fall behind before it is dropped */
+
 /* State file for window persistence */
 #define STATEFILE "/tmp/mwm-state.json"
+#define STATEDELAY 1.0  /* seconds to coalesce state writes */
+#define STATEMAXDELAY 5.0  /* seconds a write may be pushed back in all */
+
+/* Session snapshot, lets a restarted mwm put every window back */
+#define SESSIONFILE "/tmp/mwm-session.json"
+#define DISPLAYDELAY 0.3  /* seconds to let display reconfiguration settle */
+#define CYCLEDELAY 0.8  /* seconds between focuslast presses that keep one cycle */
+#define CYCLEMODS (kCGEventFlagMaskAlternate | kCGEventFlagMaskCommand | kCGEventFlagMaskControl)
+
+/* Metrics dump written on SIGUSR1, read by mwm -m */
+#define METRICSFILE "/tmp/mwm-metrics.txt"
 
 /* macros */
 #define LENGTH(X)       (sizeof(X) / sizeof(X[0]))
@@ -36,6 +61,16 @@ static int pidfd = -1;
 #define MIN(A, B)       ((A) < (B) ? (A) : (B))
 #endif
 #define TAGMASK         ((1 << LENGTH(tags)) - 1)
+#define CURTAG(M)       ((M)->pertag->curtag)
+#define LAYOUT(M)       ((M)->pertag->lay[CURTAG(M)])
+#define MFACT(M)        ((M)->pertag->mfact[CURTAG(M)])
+#define NMASTER(M)      ((M)->pertag->nmaster[CURTAG(M)])
+#define GAP(M)          ((M)->pertag->gap[CURTAG(M)])
+#define WINHASHSIZE     256  /* power of two */
+#define STATEHASHSIZE   64   /* power of two */
+#define RULEHASHSIZE    256  /* power of two */
+#define CMDQUEUESIZE    64   /* pending binding and socket actions */
+#define SLABSIZE        64   /* clients per pool slab */
 
 #define TAGKEYS(KEY,TAG) \
     { MODKEY,           KEY, view,      {.ui = 1 << TAG} }, \
@@ -47,6 +82,24 @@ static int pidfd = -1;
 #define Mod4        (1 << 1)  /* Command */
 #define ShiftMask   (1 << 2)
 #define CtrlMask    (1 << 3)
+#define NMODS       (1 << 4)  /* every combination of the masks above */
+#define NKEYCODES   128       /* virtual key codes are 7 bit */
+
+/* enums */
+enum { Shown, HiddenOffscreen, HiddenMinimized, HiddenApp };  /* Client.hidden */
+enum { HideOffscreen, HideMinimize, HideApp };                /* hidemode strategies */
+enum { ArgNone, ArgInt, ArgFloat, ArgTag, ArgLayout, ArgShell, ArgDir }; /* control socket argument types */
+enum { DirLeft, DirRight, DirUp, DirDown };                   /* focusdir/swapdir */
+
+/* events pushed to subscribers */
+enum { EvFocus, EvView, EvLayout, EvManage, EvUnmanage, EvLast };
+
+/* AX writes broken out in the metrics */
+enum { AxPosition, AxSize, AxMain, AxFocused, AxFrontmost, AxHidden, AxMinimized, AxLast };
+
+/* AX reads broken out in the metrics */
+enum { RdPosition, RdSize, RdMinimized, RdSubrole, RdTitle, RdFocusedWindow, RdWindows,
+       RdCloseButton, RdWindowList, RdLast };
 
 /* types */
 typedef union {
@@ -64,109 +117,560 @@ typedef struct {
 } Key;
 
 typedef struct {
-    const char *app;
+    void (*func)(const Arg *);
+    Arg arg;
+    uint64_t queued;  /* metrics_now() at enqueue */
+} Command;
+
+typedef struct {
+    const char *app;    /* NULL matches every app */
+    const char *title;  /* NULL matches every window */
     unsigned int tags;
     int isfloating;
 } Rule;
 
+typedef struct {
+    const char *app;    /* substring of the app name or exact bundle id */
+    const char *title;  /* substring of the window title, NULL matches every window */
+    const char **cmd;   /* started if no window matches */
+    float x, y, w, h;   /* first frame, as fractions of the monitor */
+} Scratchpad;
+
+/* Aho-Corasick trie over the app patterns of rules[] */
+typedef struct {
+    unsigned char ch;
+    int child;          /* first child, 0 = none */
+    int sibling;        /* next child of the same parent, 0 = none */
+    int fail;           /* longest proper suffix that is also a prefix */
+    int out;            /* nearest node on the fail chain ending a pattern, 0 = none */
+    int rule;           /* first rule whose pattern ends here, -1 = none */
+} RuleNode;
+
+typedef struct App App;
 typedef struct Client Client;
+typedef struct ClientInfo ClientInfo;
+typedef struct Monitor Monitor;
+
+/* hot per-window data walked by layouts and focus traversal */
 struct Client {
-    char name[256];
-    CGRect frame;
-    AXUIElementRef win;
+    CGRect frame;       /* last geometry applied to or reported by the window */
+    CGRect target;      /* geometry computed by the current layout pass */
+    CGWindowID wid;     /* 0 if the window server id is unknown */
     pid_t pid;
+    App *app;           /* owning process, outlives its clients */
     unsigned int tags;
     int isfloating;
+    int issticky;       /* shown in every view of the display owning its tags */
     int isfullscreen;
+    int arranged;       /* target set by the layout, pending applyframes() */
+    int hidden;         /* how the window is currently hidden, Shown if not */
+    CGRect restore;     /* on-screen frame to return to after an offscreen hide */
+    Monitor *mon;       /* monitor showing this client, NULL if hidden */
+    int visidx;         /* position in mon->vis */
+    int64_t order;      /* position in the client list, lower is nearer the head */
+    unsigned int visgen;  /* last updatemonvis() pass that looked at it */
+    int scratch;        /* 1 + index into scratchpads[], 0 if not one */
     Client *next;
     Client *prev;
+    Client *mnext;      /* focus history ring of a monitor, towards older */
+    Client *mprev;      /* towards newer, both NULL if never focused */
+    Client *hnext;      /* winhash bucket chain */
+    ClientInfo *info;   /* fixed slot in the same slab */
+};
+
+typedef struct Slab Slab;
+
+struct App {
+    pid_t pid;
+    char name[256];     /* localized app name, "" until known */
+    char bundle[256];   /* bundle identifier, may stay "" */
+    AXUIElementRef ax;
+    AXObserverRef obs;  /* NULL until the app accepts notifications */
+    unsigned int scanned;  /* last updateclients() pass that visited this app */
+    int *rules;         /* matching rule indices in order, valid if rulesdone */
+    int nrules;
+    int rulesdone;
+    dispatch_queue_t lane; /* serial queue for this app's AX writes */
+    int hidden;         /* kAXHiddenAttribute last requested by mwm */
+    int nclients, nshown;  /* scratch counts for showhide() */
+    App *next;
+};
+
+typedef struct StateEntry StateEntry;
+struct StateEntry {
+    char app[256];
+    unsigned int tags;
+    int isfloating;
+    StateEntry *next;
 };
 
+/* window of the last session, see loadsession() */
+typedef struct {
+    CGWindowID wid;     /* 0 if it was unknown */
+    char app[256];
+    char title[256];
+    unsigned int tags;
+    int isfloating;
+    int issticky;
+    CGRect frame;       /* on-screen frame, also while it was hidden */
+    int order;          /* position in the client list */
+    Client *client;     /* window it was matched to, NULL if none yet */
+} SessionEntry;
+
+typedef struct {
+    AXUIElementRef win;     /* window, or app element for attr ops */
+    CGPoint pos;
+    CGSize size;
+    int move;
+    int resize;
+    CFStringRef attr;       /* boolean attribute to set, NULL if none */
+    int value;
+    int axattr;             /* metrics slot of attr */
+    pid_t pid;              /* owner, for per-app metrics */
+} FrameOp;
+
 typedef struct {
     const char *symbol;
-    void (*arrange)(void);
+    LayoutFunc arrange;  /* NULL = floating */
 } Layout;
 
+typedef struct Pertag Pertag;
+
+/* one axis of the spatial index, see updatespatial() */
+typedef struct {
+    CGFloat key;        /* center of the frame along the axis */
+    Client *c;
+} SpatialEntry;
+
+/* Every query and command mwm sends to apps and the window server,
+ * so bench.c can run mwm against a simulated one */
+typedef struct {
+    AXError (*copyattr)(AXUIElementRef el, CFStringRef attr, CFTypeRef *value);
+    AXError (*setattr)(AXUIElementRef el, CFStringRef attr, CFTypeRef value);
+    AXError (*action)(AXUIElementRef el, CFStringRef action);
+    AXError (*settimeout)(AXUIElementRef el, float seconds);
+    AXError (*getwindow)(AXUIElementRef el, CGWindowID *wid);
+    AXUIElementRef (*createapp)(pid_t pid);
+    AXError (*createobserver)(pid_t pid, AXObserverCallback cb, AXObserverRef *obs);
+    CFArrayRef (*windowlist)(void);  /* on-screen windows, like CGWindowListCopyWindowInfo */
+    int (*appinfo)(pid_t pid, char *name, size_t namesz, char *bundle, size_t bundlesz);
+} Backend;
+
+typedef struct Conn Conn;
+struct Conn {
+    int fd;
+    CFSocketRef sock;
+    CFRunLoopSourceRef src;
+    char buf[1024];         /* partial command line */
+    size_t len;
+    char *out;              /* reply bytes the socket did not take yet */
+    size_t outlen, outcap;
+    int closing;            /* request/reply done, close once out is sent */
+    int dead;               /* write failed, close after this callback */
+    unsigned int events;    /* subscribed event mask, 0 = request/reply */
+    Conn *next;
+};
+
+typedef struct {
+    const char *name;
+    void (*func)(const Arg *);
+    int type;               /* how to parse the argument */
+} IpcCommand;
+
+typedef struct {
+    const char *name;
+    void (*func)(Conn *c, const char *arg);
+} IpcQuery;
+
+/* what the last layout of a monitor read, see layoutsame() */
+typedef struct {
+    Client *c;
+    CGWindowID wid;
+} LayoutClient;
+
 typedef struct {
+    int layout, nmaster, gap, nvis;
+    float mfact;
+    CGRect rect;
+    LayoutClient *tiled;   /* in order */
+    int ntiled;
+    int cap;
+} LayoutInputs;
+
+struct Monitor {
     CGDirectDisplayID id;
     CGRect rect;
     unsigned int tags;  /* which workspaces belong to this monitor */
     unsigned int tagset[2];  /* current and previous tag views */
     unsigned int seltags;  /* index into tagset array */
-} Monitor;
+    Client **vis;       /* visible clients in client list order */
+    int nvis;
+    int viscap;
+    Pertag *pertag;     /* layout parameters of each tag view */
+    Client *mru;        /* most recently focused client, head of its ring */
+    int visdirty;       /* vis needs a rebuild, see updatevisible() */
+    uint64_t layoutsig; /* hash of the inputs of the last layout, 0 = dirty */
+    LayoutInputs last;  /* those inputs, compared when the hash matches */
+};
 
 /* forward declarations needed for ISVISIBLE */
 static Monitor *monitors;
 static int nmonitors;
 
-/* ISVISIBLE checks if window is visible on ANY monitor */
+/* ISVISIBLE checks if window is visible on ANY monitor, O(1) unless
+ * the visible sets are dirty */
 static inline int isvisible(Client *c);
 #define ISVISIBLE(C)    isvisible(C)
 
 /* function declarations */
+static void applaunched(pid_t pid);
+static void appactivated(pid_t pid);
+static void appterminated(pid_t pid);
+static void applyframes(void);
+static Client *allocclient(void);
+static void attach(Client *c);
 static void arrange(void);
-static int canmanage(AXUIElementRef win);
+static void arrangemon(Monitor *m);
+static void layoutkeep(Monitor *m);
+static int layoutsame(Monitor *m);
+static uint64_t layoutsig(Monitor *m);
+static uint64_t sigbits(double v);
+static Client *mrulast(Monitor *m, Client *skip);
+static void mrulink(Monitor *m, Client *c);
+static Client *mrunext(Monitor *m, Client *from);
+static void mrusplice(Monitor *m, Client *head);
+static void mruunlink(Client *c);
+static void armscan(void);
+static void axrecord(int attr, pid_t pid, uint64_t start);
+static void axcallback(AXObserverRef obs, AXUIElementRef el, CFStringRef notification, void *ctx);
+static int canmanage(AXUIElementRef win, pid_t pid);
+static void claimscratch(Client *c, unsigned int i);
 static void cleanup(void);
 static void cyclelayout(const Arg *arg);
 static void detach(Client *c);
 static void die(const char *fmt, ...);
+static void dirtyall(void);
+static void dirtymon(Monitor *m);
+static void dirtytags(unsigned int t);
+static Monitor *dirmon(Monitor *from, int dir);
+static CGFloat dirscore(CGRect from, CGRect to, int dir);
+static void dumpmetrics(void *ctx);
+static void emit(int ev, cJSON *o);
+static void emitclient(int ev, Client *c);
+static void emitlayout(Monitor *m);
+static void emitview(Monitor *m);
+static int enqueue(void (*func)(const Arg *), const Arg *arg);
+static void hashclient(Client *c, int on);
 static void focus(Client *c);
+static void freeclient(Client *c);
 static void focuslast(const Arg *arg);
+static void endcycle(const Arg *arg);
+static void cycletimercallback(CFRunLoopTimerRef timer, void *info);
+static void focusdir(const Arg *arg);
 static void focusleftmon(const Arg *arg);
+static void focusmon(Monitor *m);
 static void focusnext(const Arg *arg);
 static void focusprev(const Arg *arg);
+static void flushframes(void);
 static void focusrightmon(const Arg *arg);
-static CGRect getframe(AXUIElementRef win);
+static void forget(Client *c);
+static const char *clientapp(Client *c);
+static App *findapp(pid_t pid);
+static App *getapp(pid_t pid);
+static AXError copyattr(AXUIElementRef el, CFStringRef attr, CFTypeRef *value, int rd, pid_t pid);
+static CGRect getframe(AXUIElementRef win, pid_t pid);
 static void grabkeys(void);
+static void hidescratch(Client *c);
 static void incnmaster(const Arg *arg);
+static void ipcaccept(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info);
+static int ipcclient(int argc, char *argv[]);
+static void ipcclients(Conn *c, const char *arg);
+static void ipcclose(Conn *c);
+static void ipcexec(Conn *c, char *line);
+static void ipcflush(Conn *c);
+static void ipcjson(Conn *c, cJSON *json);
+static void ipcmetrics(Conn *c, const char *arg);
+static void ipcmonitors(Conn *c, const char *arg);
+static int ipcparsearg(int type, const char *s, Arg *arg, const char **err);
+static void ipcprintf(Conn *c, const char *fmt, ...);
+static void ipcread(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info);
+static void ipcsetup(void);
+static void ipcstatus(Conn *c, const char *arg);
+static void ipcsubscribe(Conn *c, const char *arg);
+static void ipcwrite(Conn *c, const char *s, size_t len);
 static void killclient(const Arg *arg);
 static void manage(AXUIElementRef win, pid_t pid);
-static void monocle(void);
+static void applyrules(Client *c);
+static void compilerules(void);
+static void freerules(void);
 static void movewindow(AXUIElementRef win, CGPoint pos);
+static void observeapp(App *a);
+static void observewindow(Client *c, int on);
+static void queueattr(App *a, AXUIElementRef el, CFStringRef attr, int value);
+static void queueframe(Client *c, CGRect r, int move, int resize);
+static void queueop(App *a, FrameOp *op);
+static int printmetrics(void);
 static void quit(const Arg *arg);
+static void removeapp(App *a);
 static void resizewindow(AXUIElementRef win, CGSize size);
 static void run(void);
+static void runcommands(void *info);
+static void runframeop(void *ctx);
+static int scratchmatch(const Scratchpad *s, Client *c);
+static void clearstate(void);
+static StateEntry *findstate(const char *appname);
+static void flushstate(int sync);
+static void loadsession(void);
 static void loadstate(void);
+static int matchsession(Client *c);
+static void putstate(const char *appname, unsigned int tags, int floating);
+static cJSON *readjson(const char *path);
+static void requestarrange(void);
+static void restoremon(Monitor *m, cJSON *o);
+static void restoresession(void);
 static int restorestate(const char *appname, unsigned int *tags, int *floating);
+static void savesession(void);
 static void savestate(void);
-static void scan(void);
+static char *sessionjson(void);
+static int scan(void);
+static void schedulescan(int changed);
 static void setupmonitors(void);
+static void updatemonitors(void);
+static Pertag *newpertag(void);
 static Monitor* getmonitor(CGRect frame);
-static Monitor* getmonitorbytags(unsigned int tags);
+static Monitor* getmonitorbytags(unsigned int t);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setgap(const Arg *arg);
+static void setfocused(Client *c);
+static void settarget(Client *c, CGRect r);
 static void setup(void);
-static void sighandler(int sig);
+static void sethidden(Client *c, int state);
+static void showhide(void);
+static void showscratch(Client *c);
+static void sighandler(void *ctx);
 static void spawn(const Arg *arg);
+static unsigned int strhash(const char *str);
+static Client *spatialfind(Client *from, int dir, int tiled);
+static void setsticky(Client *c, int sticky);
+static void settags(Client *c, unsigned int t);
+static void swapclients(Client *a, Client *b);
+static void swapdir(const Arg *arg);
 static void swapnext(const Arg *arg);
 static void swapprev(const Arg *arg);
 static void tag(const Arg *arg);
-static void tile(void);
+static void tagattach(Client *c, unsigned int t);
+static void tagdetach(Client *c, unsigned int t);
 static void togglefloat(const Arg *arg);
+static void togglescratch(const Arg *arg);
+static void togglesticky(const Arg *arg);
 static void toggleview(const Arg *arg);
 static void unmanage(Client *c);
+static void unstick(Client *c);
+static void scanapp(App *a);
 static void updateclients(void);
+static void updatespatial(void);
 static void updatestatusbar(void);
+static void updatemonvis(Monitor *m);
+static int ordercmp(const void *a, const void *b);
+static void visadd(Monitor *m, Client *c);
+static void updatevisible(void);
+static void writemetrics(FILE *f);
+static void updatetitle(Client *c);
+static void updatecurtag(Monitor *m);
+static void writefile(const char *path, char *data);
 static void view(const Arg *arg);
+static void zoom(const Arg *arg);
+static CGWindowID windowid(AXUIElementRef win);
+static Client *wintoclient(AXUIElementRef win);
 
 /* configuration - include first for constants */
-#include "config.h"
+#ifndef CONFIG
+#define CONFIG "config.h"  /* tests/ builds against its own rules */
+#endif
+#include CONFIG
+
+struct Pertag {
+    unsigned int curtag;  /* 1-based tag of the view, 0 = several tags */
+    int lay[LENGTH(tags) + 1];
+    float mfact[LENGTH(tags) + 1];
+    int nmaster[LENGTH(tags) + 1];
+    int gap[LENGTH(tags) + 1];
+};
+
+/* cold per-window data, only touched when talking to the window or
+ * when its tags change */
+struct ClientInfo {
+    char name[256];
+    AXUIElementRef win;
+    int tagidx[LENGTH(tags)];  /* position in tagclients[] of each of its tags */
+};
+
+/* clients are carved from slabs and recycled through a freelist */
+struct Slab {
+    Client hot[SLABSIZE];
+    ClientInfo cold[SLABSIZE];
+    Slab *next;
+};
+
+_Static_assert(LENGTH(tagmon) == LENGTH(tags), "tagmon[] needs one entry per tag");
 
 /* global variables */
-static int running = 1;
-static int windowschanged = 0;
+static int arrangepending = 0;
+static Slab *slabs = NULL;
+static Client *freeclients = NULL;  /* linked through next */
+static unsigned int scangen = 0;    /* current updateclients() pass */
+static int visdirty = 1;           /* some monitor's visible set needs a rebuild */
+static unsigned int visgen = 0;    /* current updatemonvis() pass */
+static Client **tagclients[LENGTH(tags)];  /* clients on each tag, unordered */
+static int ntagclients[LENGTH(tags)], tagclientcap[LENGTH(tags)];
+static Client **stickies = NULL;   /* sticky clients, they ignore the views */
+static int nstickies = 0, stickycap = 0;
+static int64_t headorder = 0;      /* order of the list head, see attach() */
+static SpatialEntry *spatial[2];   /* shown clients by frame center x and y */
+static int nspatial = 0, spatialcap = 0;
+static int spatialdirty = 1;       /* shown frames changed since updatespatial() */
+static unsigned int occupied = 0;  /* tags with at least one client */
 static Client *clients = NULL;
 static Client *sel = NULL;
-static Client *lastsel = NULL;
+static Client *focused = NULL;  /* window the system reports focused, NULL if unknown */
+static pid_t frontpid = 0;      /* frontmost application */
+static App *apps = NULL;
+static Client *winhash[WINHASHSIZE];
+static dispatch_group_t applygroup = NULL;
+static CFRunLoopTimerRef scantimer = NULL;
+static double scandelay = 0;          /* current rescan interval */
+static CFAbsoluteTime scanfastuntil = 0;  /* end of the fast scan window */
+static RuleNode *rulenodes = NULL;
+static int nrulenodes = 0, rulenodecap = 0;
+static int rulenext[LENGTH(rules)];   /* next rule in the same trie node / anyrule chain */
+static int rulebnext[LENGTH(rules)];  /* next rule in the same bundle hash bucket */
+static int rulebundle[RULEHASHSIZE];
+static int anyrule = -1;              /* rules without an app pattern */
+static StateEntry *statehash[STATEHASHSIZE];
+static int statedirty = 0;
+static SessionEntry *session = NULL;  /* last session, until restoresession() */
+static int nsession = 0;
+static CGWindowID sessionsel = 0;     /* window that had focus in it */
+static int sessiondirty = 0;
+static CFRunLoopTimerRef statetimer = NULL;
+static CFAbsoluteTime statefirst = 0;  /* when unwritten changes began, 0 = none */
+static CFRunLoopTimerRef displaytimer = NULL;
+static CFRunLoopTimerRef cycletimer = NULL;
+static _Atomic int cycling = 0;   /* focuslast is walking a frozen ring, read by the tap */
+static Client *cyclesel = NULL;    /* where focuslast went, its focus does not reorder */
+static dispatch_queue_t statequeue = NULL;
+static const int stopsignals[] = { SIGINT, SIGTERM };
+static dispatch_source_t sigsrc[LENGTH(stopsignals)];
+static int nunhashed = 0;  /* clients without a window id, matched by CFEqual */
 static Monitor *monitors = NULL;
 static int nmonitors = 0;
-static float g_mfact;
-static int g_nmaster;
-static unsigned int seltags = 0;
-static unsigned int tagset[] = {1, 1};
-static int sellay = 0;
+static Monitor *selmon = NULL;
+static Monitor *tagowner[LENGTH(tags)];  /* display of each tag, see assigntags() */
+static Histogram scanhist, arrangehist, keyhist;
+static Histogram layouthist[LENGTH(layouts)];
+static Histogram axhist[AxLast];
+static const char *axnames[AxLast] = {
+    [AxPosition] = "position", [AxSize] = "size", [AxMain] = "main",
+    [AxFocused] = "focused", [AxFrontmost] = "frontmost",
+    [AxHidden] = "hidden", [AxMinimized] = "minimized",
+};
+static Histogram axreadhist[RdLast];
+static const char *axreadnames[RdLast] = {
+    [RdPosition] = "position", [RdSize] = "size", [RdMinimized] = "minimized",
+    [RdSubrole] = "subrole", [RdTitle] = "title", [RdFocusedWindow] = "focused window",
+    [RdWindows] = "windows", [RdCloseButton] = "close button",
+    [RdWindowList] = "window list",
+};
+static dispatch_source_t metricsrc = NULL;
+static CFSocketRef ipcsock = NULL;
+static CFRunLoopSourceRef ipcsrc = NULL;
+static Conn *conns = NULL;
+static Conn *ipccur = NULL;       /* connection whose commands are running */
+static unsigned int submask = 0;  /* events any connection subscribed to */
+static const char *evnames[EvLast] = {
+    [EvFocus] = "focus", [EvView] = "view", [EvLayout] = "layout",
+    [EvManage] = "manage", [EvUnmanage] = "unmanage",
+};
+
+/* actions reachable through the control socket */
+static const IpcCommand ipccommands[] = {
+    /* name             function        argument */
+    { "view",           view,           ArgTag },
+    { "toggleview",     toggleview,     ArgTag },
+    { "tag",            tag,            ArgTag },
+    { "setlayout",      setlayout,      ArgLayout },
+    { "cyclelayout",    cyclelayout,    ArgNone },
+    { "setmfact",       setmfact,       ArgFloat },
+    { "incnmaster",     incnmaster,     ArgInt },
+    { "setgap",         setgap,         ArgInt },
+    { "focusnext",      focusnext,      ArgNone },
+    { "focusprev",      focusprev,      ArgNone },
+    { "focuslast",      focuslast,      ArgNone },
+    { "focusleftmon",   focusleftmon,   ArgNone },
+    { "focusrightmon",  focusrightmon,  ArgNone },
+    { "focusdir",       focusdir,       ArgDir },
+    { "swapdir",        swapdir,        ArgDir },
+    { "swapnext",       swapnext,       ArgNone },
+    { "swapprev",       swapprev,       ArgNone },
+    { "zoom",           zoom,           ArgNone },
+    { "togglefloat",    togglefloat,    ArgNone },
+    { "togglesticky",   togglesticky,   ArgNone },
+    { "togglescratch",  togglescratch,  ArgInt },
+    { "killclient",     killclient,     ArgNone },
+    { "spawn",          spawn,          ArgShell },
+    { "quit",           quit,           ArgNone },
+};
+
+/* state queries, answered with one line of JSON */
+static const IpcQuery ipcqueries[] = {
+    { "status",         ipcstatus },
+    { "clients",        ipcclients },
+    { "monitors",       ipcmonitors },
+    { "metrics",        ipcmetrics },
+    { "subscribe",      ipcsubscribe },
+};
+static unsigned short keymap[NKEYCODES][NMODS];  /* index into keys[] + 1, 0 = unbound */
+static unsigned int keymods = 0;                  /* bit per modifier combination in use */
 static CFMachPortRef evtap = NULL;
 static CFRunLoopSourceRef rlsrc = NULL;
+static pthread_t tapthread;
+static int tapthreadok = 0;
+static Command cmdqueue[CMDQUEUESIZE];
+static unsigned int cmdhead = 0, cmdtail = 0;  /* ring indices, guarded by cmdlock */
+static pthread_mutex_t cmdlock = PTHREAD_MUTEX_INITIALIZER;
+static CFRunLoopSourceRef cmdsrc = NULL;
+
+static Client *scratchclients[LENGTH(scratchpads)];
+static int scratchpending[LENGTH(scratchpads)];  /* show the window once it appears */
+static int scratchplaced[LENGTH(scratchpads)];   /* shown since it was claimed */
+
+extern char **environ;
+
+/* private, but stable and used by every AX based window manager */
+extern AXError _AXUIElementGetWindow(AXUIElementRef win, CGWindowID *wid);
+
+static CFArrayRef
+axwindowlist(void) {
+    return CGWindowListCopyWindowInfo(
+        kCGWindowListOptionOnScreenOnly | kCGWindowListExcludeDesktopElements,
+        kCGNullWindowID
+    );
+}
+
+/* the real window server */
+static const Backend axbackend = {
+    .copyattr = AXUIElementCopyAttributeValue,
+    .setattr = AXUIElementSetAttributeValue,
+    .action = AXUIElementPerformAction,
+    .settimeout = AXUIElementSetMessagingTimeout,
+    .getwindow = _AXUIElementGetWindow,
+    .createapp = AXUIElementCreateApplication,
+    .createobserver = AXObserverCreate,
+    .windowlist = axwindowlist,
+    .appinfo = workspace_appinfo,
+};
+static const Backend *backend = &axbackend;
 
 /* function implementations */
 static void
@@ -181,41 +685,251 @@ die(const char *fmt, ...) {
 static inline int
 isvisible(Client *c) {
     /* check if window is visible on any monitor */
-    for (int i = 0; i < nmonitors; i++) {
-        if (c->tags & monitors[i].tagset[monitors[i].seltags])
-            return 1;
+    if (visdirty)
+        updatevisible();
+    return c->mon != NULL;
+}
+
+static void
+dirtymon(Monitor *m) {
+    if (!m)
+        return;
+    m->visdirty = 1;
+    visdirty = 1;
+}
+
+static void
+dirtytags(unsigned int t) {
+    /* the displays viewing or owning any of t, sticky clients follow the owner */
+    for (int i = 0; i < nmonitors; i++)
+        if ((monitors[i].tagset[monitors[i].seltags] | monitors[i].tags) & t)
+            dirtymon(&monitors[i]);
+}
+
+static void
+dirtyall(void) {
+    for (int i = 0; i < nmonitors; i++)
+        dirtymon(&monitors[i]);
+    visdirty = 1;
+}
+
+static void
+tagattach(Client *c, unsigned int t) {
+    /* c joins the array of every tag in t, O(tags) */
+    for (t &= TAGMASK; t; t &= t - 1) {
+        int i = __builtin_ctz(t);
+
+        if (ntagclients[i] == tagclientcap[i]) {
+            tagclientcap[i] = tagclientcap[i] ? tagclientcap[i] * 2 : 16;
+            tagclients[i] = realloc(tagclients[i], tagclientcap[i] * sizeof(Client *));
+            if (!tagclients[i])
+                die("mwm: cannot allocate memory\n");
+        }
+        c->info->tagidx[i] = ntagclients[i];
+        tagclients[i][ntagclients[i]++] = c;
     }
-    return 0;
 }
 
 static void
-updatestatusbar(void) {
-    /* calculate current tag number (1-based) from bitmask */
-    int tag = 1;
-    unsigned int t = tagset[seltags];
-    while (t > 1) {
-        t >>= 1;
-        tag++;
+tagdetach(Client *c, unsigned int t) {
+    /* the last client of each array fills the hole */
+    for (t &= TAGMASK; t; t &= t - 1) {
+        int i = __builtin_ctz(t), k = c->info->tagidx[i];
+        Client *last = tagclients[i][--ntagclients[i]];
+
+        tagclients[i][k] = last;
+        last->info->tagidx[i] = k;
+    }
+}
+
+static void
+settags(Client *c, unsigned int t) {
+    /* only the displays that showed it or may show it now are rebuilt */
+    dirtymon(c->mon);
+    dirtytags(c->tags | t);
+    tagdetach(c, c->tags);
+    c->tags = t;
+    tagattach(c, t);
+}
+
+static void
+unstick(Client *c) {
+    int i;
+
+    for (i = 0; i < nstickies && stickies[i] != c; i++);
+    if (i < nstickies)
+        stickies[i] = stickies[--nstickies];
+}
+
+static void
+setsticky(Client *c, int sticky) {
+    if (!c->issticky == !sticky)
+        return;
+    dirtymon(c->mon);
+    dirtytags(c->tags);
+    c->issticky = sticky;
+    if (!sticky) {
+        unstick(c);
+        return;
+    }
+    if (nstickies == stickycap) {
+        stickycap = stickycap ? stickycap * 2 : 8;
+        stickies = realloc(stickies, stickycap * sizeof(Client *));
+        if (!stickies)
+            die("mwm: cannot allocate memory\n");
+    }
+    stickies[nstickies++] = c;
+}
+
+static int
+ordercmp(const void *a, const void *b) {
+    int64_t x = (*(Client *const *)a)->order, y = (*(Client *const *)b)->order;
+
+    return (x > y) - (x < y);
+}
+
+static void
+visadd(Monitor *m, Client *c) {
+    if (m->nvis == m->viscap) {
+        m->viscap = m->viscap ? m->viscap * 2 : 16;
+        m->vis = realloc(m->vis, m->viscap * sizeof(Client *));
+        if (!m->vis)
+            die("mwm: cannot allocate memory\n");
+    }
+    m->vis[m->nvis++] = c;
+}
+
+static void
+updatemonvis(Monitor *m) {
+    static Client **old = NULL;
+    static int oldcap = 0;
+    unsigned int view = m->tagset[m->seltags] & TAGMASK;
+    int nold = m->nvis, k;
+    Client *c;
+
+    /* it gives up what it showed, unless another display took it since */
+    if (nold > oldcap) {
+        oldcap = nold;
+        old = realloc(old, oldcap * sizeof(Client *));
+        if (!old)
+            die("mwm: cannot allocate memory\n");
+    }
+    memcpy(old, m->vis, nold * sizeof(Client *));
+    for (k = 0; k < nold; k++)
+        if (old[k]->mon == m)
+            old[k]->mon = NULL;
+    m->nvis = 0;
+    m->visdirty = 0;
+
+    /* the clients of the viewed tags, each once; a client on the view of
+     * several displays goes to the first, as monitors[] is rebuilt in order */
+    visgen++;
+    for (unsigned int t = view; t; t &= t - 1) {
+        int i = __builtin_ctz(t);
+
+        for (k = 0; k < ntagclients[i]; k++) {
+            c = tagclients[i][k];
+            if (c->visgen == visgen || c->issticky)
+                continue;
+            c->visgen = visgen;
+            if (c->mon && c->mon < m)
+                continue;
+            dirtymon(c->mon);  /* a later display loses it */
+            visadd(m, c);
+        }
+    }
+    for (k = 0; k < nstickies; k++)
+        if (stickies[k]->tags && getmonitorbytags(stickies[k]->tags) == m)
+            visadd(m, stickies[k]);  /* whatever that display views */
+
+    qsort(m->vis, m->nvis, sizeof(Client *), ordercmp);
+    for (k = 0; k < m->nvis; k++) {
+        m->vis[k]->mon = m;
+        m->vis[k]->visidx = k;
+    }
+
+    /* one it let go of may be on the view of a later display */
+    for (k = 0; k < nold; k++) {
+        if ((c = old[k])->mon)
+            continue;
+        for (int j = (int)(m - monitors) + 1; j < nmonitors; j++)
+            if (c->tags & monitors[j].tagset[monitors[j].seltags])
+                dirtymon(&monitors[j]);
+    }
+}
+
+static void
+updatevisible(void) {
+    /* only displays whose view or clients changed are rebuilt, from the
+     * per-tag arrays, at O(v log v) for the v clients they show; parked
+     * windows on other tags cost nothing */
+    for (int i = 0; i < nmonitors; i++)
+        if (monitors[i].visdirty)
+            updatemonvis(&monitors[i]);
+    occupied = 0;
+    for (unsigned int i = 0; i < LENGTH(tags); i++)
+        if (ntagclients[i])
+            occupied |= 1u << i;
+    visdirty = 0;
+    spatialdirty = 1;
+}
+
+static void
+attach(Client *c) {
+    /* in front of the list, and on its tags' arrays */
+    c->prev = NULL;
+    c->next = clients;
+    if (clients)
+        clients->prev = c;
+    clients = c;
+    c->order = --headorder;
+    tagattach(c, c->tags);
+    if (c->issticky) {
+        c->issticky = 0;
+        setsticky(c, 1);
     }
+    dirtytags(c->tags);
+}
 
-    /* get current layout symbol */
-    const char *layout = layouts[sellay].symbol;
+static void
+forget(Client *c) {
+    Monitor *m = c->mon;
+
+    /* out of the tag arrays and the visible set it is in, no rebuild */
+    tagdetach(c, c->tags);
+    if (c->issticky)
+        unstick(c);
+    if (m) {
+        m->nvis--;
+        memmove(&m->vis[c->visidx], &m->vis[c->visidx + 1],
+                (m->nvis - c->visidx) * sizeof(Client *));
+        for (int k = c->visidx; k < m->nvis; k++)
+            m->vis[k]->visidx = k;
+        c->mon = NULL;
+    }
+    visdirty = 1;  /* occupied */
+}
 
-    /* get current window name */
-    const char *window = sel ? sel->name : NULL;
+static void
+updatestatusbar(void) {
+    /* get current window name, falling back to the app name */
+    const char *window = sel ? (sel->info->name[0] ? sel->info->name : clientapp(sel)) : NULL;
 
-    statusbar_update(tag, layout, window);
+    /* statusbar.m drops unchanged states and redraws once per run loop pass,
+     * occupied is current as of the last visible set rebuild */
+    statusbar_update(selmon->tagset[selmon->seltags], occupied,
+                     layouts[LAYOUT(selmon)].symbol, window);
 }
 
 static int
-canmanage(AXUIElementRef win) {
+canmanage(AXUIElementRef win, pid_t pid) {
     CFBooleanRef minimized = NULL;
     CFStringRef subrole = NULL;
     int result = 0;
 
     /* skip minimized windows */
-    if (AXUIElementCopyAttributeValue(win, kAXMinimizedAttribute,
-                                       (CFTypeRef *)&minimized) == kAXErrorSuccess) {
+    if (copyattr(win, kAXMinimizedAttribute, (CFTypeRef *)&minimized,
+                 RdMinimized, pid) == kAXErrorSuccess) {
         if (CFBooleanGetValue(minimized)) {
             CFRelease(minimized);
             return 0;
@@ -224,8 +938,8 @@ canmanage(AXUIElementRef win) {
     }
 
     /* check subrole - we want standard windows */
-    if (AXUIElementCopyAttributeValue(win, kAXSubroleAttribute,
-                                       (CFTypeRef *)&subrole) == kAXErrorSuccess) {
+    if (copyattr(win, kAXSubroleAttribute, (CFTypeRef *)&subrole,
+                 RdSubrole, pid) == kAXErrorSuccess) {
         if (CFStringCompare(subrole, kAXStandardWindowSubrole, 0) == kCFCompareEqualTo) {
             result = 1;
         }
@@ -236,21 +950,21 @@ canmanage(AXUIElementRef win) {
 }
 
 static CGRect
-getframe(AXUIElementRef win) {
+getframe(AXUIElementRef win, pid_t pid) {
     CGRect frame = CGRectZero;
     AXValueRef posval = NULL, sizeval = NULL;
     CGPoint pos;
     CGSize size;
 
-    if (AXUIElementCopyAttributeValue(win, kAXPositionAttribute,
-                                       (CFTypeRef *)&posval) == kAXErrorSuccess) {
+    if (copyattr(win, kAXPositionAttribute, (CFTypeRef *)&posval,
+                 RdPosition, pid) == kAXErrorSuccess) {
         AXValueGetValue(posval, kAXValueCGPointType, &pos);
         CFRelease(posval);
         frame.origin = pos;
     }
 
-    if (AXUIElementCopyAttributeValue(win, kAXSizeAttribute,
-                                       (CFTypeRef *)&sizeval) == kAXErrorSuccess) {
+    if (copyattr(win, kAXSizeAttribute, (CFTypeRef *)&sizeval,
+                 RdSize, pid) == kAXErrorSuccess) {
         AXValueGetValue(sizeval, kAXValueCGSizeType, &size);
         CFRelease(sizeval);
         frame.size = size;
@@ -263,7 +977,7 @@ static void
 movewindow(AXUIElementRef win, CGPoint pos) {
     AXValueRef posval = AXValueCreate(kAXValueCGPointType, &pos);
     if (posval) {
-        AXUIElementSetAttributeValue(win, kAXPositionAttribute, posval);
+        backend->setattr(win, kAXPositionAttribute, posval);
         CFRelease(posval);
     }
 }
@@ -272,7 +986,7 @@ static void
 resizewindow(AXUIElementRef win, CGSize size) {
     AXValueRef sizeval = AXValueCreate(kAXValueCGSizeType, &size);
     if (sizeval) {
-        AXUIElementSetAttributeValue(win, kAXSizeAttribute, sizeval);
+        backend->setattr(win, kAXSizeAttribute, sizeval);
         CFRelease(sizeval);
     }
 }
@@ -280,55 +994,37 @@ resizewindow(AXUIElementRef win, CGSize size) {
 static void
 manage(AXUIElementRef win, pid_t pid) {
     Client *c;
-    CFStringRef titleref = NULL;
-    ProcessSerialNumber psn;
-    CFStringRef appname = NULL;
 
-    c = calloc(1, sizeof(Client));
-    if (!c)
-        die("mwm: cannot allocate memory\n");
+    c = allocclient();
 
-    c->win = win;
+    c->info->win = win;
     CFRetain(win);
+    backend->settimeout(win, axtimeout);
     c->pid = pid;
-    c->tags = tagset[seltags];
+    c->app = getapp(pid);
+    c->tags = selmon->tagset[selmon->seltags];
     c->isfloating = 0;
-    c->frame = getframe(win);
-    c->name[0] = '\0';
-
-    /* get window title */
-    if (AXUIElementCopyAttributeValue(win, kAXTitleAttribute,
-                                       (CFTypeRef *)&titleref) == kAXErrorSuccess) {
-        CFStringGetCString(titleref, c->name, sizeof(c->name), kCFStringEncodingUTF8);
-        CFRelease(titleref);
-    }
-
-    /* apply rules */
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-    GetProcessForPID(pid, &psn);
-    CopyProcessName(&psn, &appname);
-#pragma clang diagnostic pop
-
-    if (appname) {
-        char app[256];
-        CFStringGetCString(appname, app, sizeof(app), kCFStringEncodingUTF8);
-        CFRelease(appname);
-
-        /* apply rules from config.h */
-        for (size_t i = 0; i < LENGTH(rules); i++) {
-            if (strstr(app, rules[i].app)) {
-                if (rules[i].tags)
-                    c->tags = rules[i].tags;
-                c->isfloating = rules[i].isfloating;
-                break;
-            }
-        }
+    c->wid = windowid(win);
+    c->frame = getframe(win, pid);
+    updatetitle(c);
+
+    /* the same window in the last session wins over rules and saved
+     * state, those are for windows mwm has not seen before */
+    const char *app = clientapp(c);
+    if (matchsession(c)) {
+#ifdef DEBUG
+        printf("mwm: restored '%s' from the last session -> tags=%u, floating=%d\n",
+               c->info->name, c->tags, c->isfloating);
+        fflush(stdout);
+#endif
+    } else {
+        /* rules without an app apply to unnamed apps too */
+        applyrules(c);
 
-        /* restore saved state (overrides rules) */
+        /* restore saved state (overrides rules), kept by app name */
         unsigned int saved_tags = 0;
         int saved_floating = 0;
-        if (restorestate(app, &saved_tags, &saved_floating)) {
+        if (app[0] && restorestate(app, &saved_tags, &saved_floating)) {
             if (saved_tags)
                 c->tags = saved_tags;
             c->isfloating = saved_floating;
@@ -340,597 +1036,1799 @@ manage(AXUIElementRef win, pid_t pid) {
         }
     }
 
-    /* attach to client list */
-    c->next = clients;
-    if (clients)
-        clients->prev = c;
-    clients = c;
+    attach(c);
+    hashclient(c, 1);
 
-    focus(c);
+    /* only a scratchpad that togglescratch just started claims a new
+     * window, any other match stays an ordinary window until adopted */
+    int show = 0;
+    for (unsigned int i = 0; i < LENGTH(scratchpads); i++) {
+        if (scratchpending[i] && !scratchclients[i] && scratchmatch(&scratchpads[i], c)) {
+            show = 1;
+            claimscratch(c, i);
+            break;
+        }
+    }
+
+    observewindow(c, 1);
+    emitclient(EvManage, c);
+
+    /* restoresession() focuses the old window once all are back */
+    if (show)
+        showscratch(c);
+    else if (!session && !c->scratch)
+        focus(c);
 }
 
 static void
 unmanage(Client *c) {
+    Monitor *m = c->mon;  /* forget() clears it */
+
+    emitclient(EvUnmanage, c);
+    observewindow(c, 0);
+    hashclient(c, 0);
     detach(c);
-    if (c->win)
-        CFRelease(c->win);
+    forget(c);
+    if (c->info->win)
+        CFRelease(c->info->win);
+    if (focused == c)
+        focused = NULL;
+
+    /* hand focus to the window used before it on the same monitor, or
+     * let the next arrange() pick one */
     if (sel == c) {
-        sel = clients;
-        if (sel)
-            focus(sel);
+        Client *next = mrulast(m ? m : selmon, c);
+
+        sel = NULL;
+        if (next)
+            focus(next);
     }
-    free(c);
+    mruunlink(c);
+    if (cyclesel == c)
+        cyclesel = NULL;
+    if (c->scratch)
+        scratchclients[c->scratch - 1] = NULL;
+    freeclient(c);
 }
 
-static void
-detach(Client *c) {
-    if (c->prev)
-        c->prev->next = c->next;
-    if (c->next)
-        c->next->prev = c->prev;
-    if (c == clients)
-        clients = c->next;
-    c->next = c->prev = NULL;
+static Client *
+allocclient(void) {
+    Client *c;
+    ClientInfo *info;
+
+    if (!freeclients) {
+        Slab *s = calloc(1, sizeof(Slab));
+        if (!s)
+            die("mwm: cannot allocate memory\n");
+        s->next = slabs;
+        slabs = s;
+        for (int i = SLABSIZE - 1; i >= 0; i--) {
+            s->hot[i].info = &s->cold[i];
+            s->hot[i].next = freeclients;
+            freeclients = &s->hot[i];
+        }
+    }
+
+    c = freeclients;
+    freeclients = c->next;
+    info = c->info;
+    memset(c, 0, sizeof(Client));
+    memset(info, 0, sizeof(ClientInfo));
+    c->info = info;
+    return c;
 }
 
 static void
-focus(Client *c) {
-    if (sel && sel != c)
-        lastsel = sel;
+freeclient(Client *c) {
+    c->next = freeclients;
+    freeclients = c;
+}
 
-    sel = c;
+static void
+updatetitle(Client *c) {
+    CFStringRef titleref = NULL;
 
-    if (!c) {
-        updatestatusbar();
-        return;
+    c->info->name[0] = '\0';
+    if (copyattr(c->info->win, kAXTitleAttribute, (CFTypeRef *)&titleref,
+                 RdTitle, c->pid) == kAXErrorSuccess) {
+        CFStringGetCString(titleref, c->info->name, sizeof(c->info->name), kCFStringEncodingUTF8);
+        CFRelease(titleref);
     }
+}
 
-    /* raise and focus the window */
-    AXUIElementSetAttributeValue(c->win, kAXMainAttribute, kCFBooleanTrue);
-    AXUIElementSetAttributeValue(c->win, kAXFocusedAttribute, kCFBooleanTrue);
-
-    /* bring app to front */
-    AXUIElementRef app = AXUIElementCreateApplication(c->pid);
-    if (app) {
-        AXUIElementSetAttributeValue(app, kAXFrontmostAttribute, kCFBooleanTrue);
-        CFRelease(app);
-    }
+static CGWindowID
+windowid(AXUIElementRef win) {
+    CGWindowID wid = 0;
 
-    updatestatusbar();
+    if (backend->getwindow(win, &wid) != kAXErrorSuccess)
+        return 0;
+    return wid;
 }
 
 static void
-focusnext(const Arg *arg) {
-    Client *c;
+hashclient(Client *c, int on) {
+    Client **cp;
 
-    if (!sel)
+    if (!c->wid) {
+        nunhashed += on ? 1 : -1;
         return;
+    }
 
-    /* find next visible client */
-    for (c = sel->next; c; c = c->next)
-        if (ISVISIBLE(c))
-            break;
-
-    if (!c) {
-        for (c = clients; c && c != sel; c = c->next)
-            if (ISVISIBLE(c))
-                break;
+    cp = &winhash[c->wid & (WINHASHSIZE - 1)];
+    if (on) {
+        c->hnext = *cp;
+        *cp = c;
+        return;
     }
 
-    if (c && c != sel)
-        focus(c);
+    for (; *cp && *cp != c; cp = &(*cp)->hnext);
+    if (*cp)
+        *cp = c->hnext;
+    c->hnext = NULL;
 }
 
-static void
-focusprev(const Arg *arg) {
-    Client *c, *last = NULL;
+static Client *
+wintoclient(AXUIElementRef win) {
+    CGWindowID wid = windowid(win);
+    Client *c;
 
-    if (!sel)
-        return;
+    if (wid) {
+        for (c = winhash[wid & (WINHASHSIZE - 1)]; c; c = c->hnext)
+            if (c->wid == wid)
+                return c;
+        if (!nunhashed)
+            return NULL;
+    }
 
-    /* find previous visible client */
-    for (c = clients; c != sel; c = c->next)
-        if (ISVISIBLE(c))
-            last = c;
+    /* destroyed elements have no window id anymore */
+    for (c = clients; c; c = c->next)
+        if (CFEqual(c->info->win, win))
+            return c;
+    return NULL;
+}
 
-    if (!last) {
-        for (c = sel->next; c; c = c->next)
-            if (ISVISIBLE(c))
-                last = c;
-    }
+static App *
+findapp(pid_t pid) {
+    App *a;
 
-    if (last && last != sel)
-        focus(last);
+    for (a = apps; a; a = a->next)
+        if (a->pid == pid)
+            return a;
+    return NULL;
 }
 
-static void
-focuslast(const Arg *arg) {
-    if (lastsel && ISVISIBLE(lastsel))
-        focus(lastsel);
+static App *
+getapp(pid_t pid) {
+    App *a = findapp(pid);
+
+    if (!a) {
+        a = calloc(1, sizeof(App));
+        if (!a)
+            die("mwm: cannot allocate memory\n");
+        a->pid = pid;
+        a->ax = backend->createapp(pid);
+        if (!a->ax) {
+            free(a);
+            return NULL;
+        }
+        backend->settimeout(a->ax, axtimeout);
+        a->next = apps;
+        apps = a;
+    }
+
+    /* apps that are still launching refuse notifications and may not be
+     * registered with NSWorkspace yet, retry until they are */
+    if (!a->obs)
+        observeapp(a);
+    if (!a->name[0])
+        backend->appinfo(pid, a->name, sizeof(a->name), a->bundle, sizeof(a->bundle));
+
+    return a;
 }
 
-static void
-focusleftmon(const Arg *arg) {
-    Monitor *m;
-    Client *c;
+static const char *
+clientapp(Client *c) {
+    return c->app ? c->app->name : "";
+}
 
-    if (!sel || nmonitors < 2)
-        return;
+static int
+rulechild(int n, unsigned char ch) {
+    int m;
 
-    /* find current monitor */
-    m = getmonitorbytags(sel->tags);
+    for (m = rulenodes[n].child; m; m = rulenodes[m].sibling)
+        if (rulenodes[m].ch == ch)
+            return m;
+    return 0;
+}
 
-    /* find the monitor to the left (geometrically) */
-    Monitor *leftmon = NULL;
-    for (int i = 0; i < nmonitors; i++) {
-        if (&monitors[i] == m)
-            continue;
-        if (monitors[i].rect.origin.x < m->rect.origin.x) {
-            if (!leftmon || monitors[i].rect.origin.x > leftmon->rect.origin.x)
-                leftmon = &monitors[i];
-        }
-    }
+static int
+addrulenode(int n, unsigned char ch) {
+    int m = rulechild(n, ch);
 
-    if (!leftmon)
-        return;
+    if (m)
+        return m;
 
-    /* find first visible client on left monitor */
-    for (c = clients; c; c = c->next) {
-        if (ISVISIBLE(c) && (c->tags & leftmon->tags)) {
-            focus(c);
-            return;
-        }
+    if (nrulenodes == rulenodecap) {
+        rulenodecap = rulenodecap ? rulenodecap * 2 : 64;
+        rulenodes = realloc(rulenodes, rulenodecap * sizeof(RuleNode));
+        if (!rulenodes)
+            die("mwm: cannot allocate memory\n");
     }
+    m = nrulenodes++;
+    rulenodes[m] = (RuleNode){ .ch = ch, .sibling = rulenodes[n].child, .rule = -1 };
+    rulenodes[n].child = m;
+    return m;
 }
 
 static void
-focusrightmon(const Arg *arg) {
-    Monitor *m;
-    Client *c;
-
-    if (!sel || nmonitors < 2)
-        return;
-
-    /* find current monitor */
-    m = getmonitorbytags(sel->tags);
-
-    /* find the monitor to the right (geometrically) */
-    Monitor *rightmon = NULL;
-    for (int i = 0; i < nmonitors; i++) {
-        if (&monitors[i] == m)
+compilerules(void) {
+    int *queue, head = 0, tail = 0;
+
+    /* the root is allocated up front, addrulenode() reads its children;
+     * being nobody's child, index 0 doubles as "none" in the links */
+    if (!rulenodecap) {
+        rulenodecap = 64;
+        rulenodes = malloc(rulenodecap * sizeof(RuleNode));
+        if (!rulenodes)
+            die("mwm: cannot allocate memory\n");
+    }
+    rulenodes[0] = (RuleNode){ .rule = -1 };
+    nrulenodes = 1;
+    anyrule = -1;
+    memset(rulebundle, -1, sizeof(rulebundle));
+
+    /* walk backwards so every chain ends up in config order */
+    for (int i = (int)LENGTH(rules) - 1; i >= 0; i--) {
+        const char *p = rules[i].app;
+        int n = 0;
+
+        if (!p || !*p) {
+            rulenext[i] = anyrule;
+            anyrule = i;
             continue;
-        if (monitors[i].rect.origin.x > m->rect.origin.x) {
-            if (!rightmon || monitors[i].rect.origin.x < rightmon->rect.origin.x)
-                rightmon = &monitors[i];
         }
-    }
 
-    if (!rightmon)
-        return;
+        /* substring match on the app name */
+        for (; *p; p++)
+            n = addrulenode(n, (unsigned char)*p);
+        rulenext[i] = rulenodes[n].rule;
+        rulenodes[n].rule = i;
 
-    /* find first visible client on right monitor */
-    for (c = clients; c; c = c->next) {
-        if (ISVISIBLE(c) && (c->tags & rightmon->tags)) {
-            focus(c);
-            return;
+        /* exact match on the bundle id */
+        unsigned int b = strhash(rules[i].app) & (RULEHASHSIZE - 1);
+        rulebnext[i] = rulebundle[b];
+        rulebundle[b] = i;
+    }
+
+    /* breadth first pass to fill in the failure links */
+    queue = malloc(nrulenodes * sizeof(int));
+    if (!queue)
+        die("mwm: cannot allocate memory\n");
+    for (int m = rulenodes[0].child; m; m = rulenodes[m].sibling) {
+        rulenodes[m].fail = rulenodes[m].out = 0;
+        queue[tail++] = m;
+    }
+    while (head < tail) {
+        int u = queue[head++];
+
+        for (int v = rulenodes[u].child; v; v = rulenodes[v].sibling) {
+            int f = rulenodes[u].fail, next;
+
+            while (f && !rulechild(f, rulenodes[v].ch))
+                f = rulenodes[f].fail;
+            next = rulechild(f, rulenodes[v].ch);
+            rulenodes[v].fail = next != v ? next : 0;
+            f = rulenodes[v].fail;
+            rulenodes[v].out = rulenodes[f].rule >= 0 ? f : rulenodes[f].out;
+            queue[tail++] = v;
         }
     }
+    free(queue);
 }
 
 static void
-swapnext(const Arg *arg) {
-    Client *c;
-
-    if (!sel || sel->isfloating)
-        return;
+freerules(void) {
+    free(rulenodes);
+    rulenodes = NULL;
+    nrulenodes = rulenodecap = 0;
+}
 
-    for (c = sel->next; c; c = c->next)
-        if (ISVISIBLE(c) && !c->isfloating)
-            break;
+static void
+matchapp(App *a) {
+    unsigned char hit[LENGTH(rules)] = {0};
+    int n = 0, i;
+
+    for (i = anyrule; i >= 0; i = rulenext[i])
+        hit[i] = 1;
+
+    /* every pattern occurring in the name, in one pass over it */
+    for (const char *p = a->name; *p; p++) {
+        unsigned char ch = (unsigned char)*p;
+        int m;
+
+        while (n && !rulechild(n, ch))
+            n = rulenodes[n].fail;
+        n = rulechild(n, ch);
+        for (m = rulenodes[n].rule >= 0 ? n : rulenodes[n].out; m; m = rulenodes[m].out)
+            for (i = rulenodes[m].rule; i >= 0; i = rulenext[i])
+                hit[i] = 1;
+    }
 
-    if (!c)
-        return;
+    if (a->bundle[0])
+        for (i = rulebundle[strhash(a->bundle) & (RULEHASHSIZE - 1)]; i >= 0; i = rulebnext[i])
+            if (!strcmp(rules[i].app, a->bundle))
+                hit[i] = 1;
 
-    /* trigger re-tile */
-    windowschanged = 1;
-    arrange();
+    free(a->rules);
+    a->rules = malloc(LENGTH(rules) * sizeof(int));
+    if (!a->rules)
+        die("mwm: cannot allocate memory\n");
+    a->nrules = 0;
+    for (i = 0; i < (int)LENGTH(rules); i++)
+        if (hit[i])
+            a->rules[a->nrules++] = i;
+    a->rulesdone = 1;
 }
 
 static void
-swapprev(const Arg *arg) {
-    Client *c, *last = NULL;
+applyrules(Client *c) {
+    App *a = c->app;
 
-    if (!sel || sel->isfloating)
+    if (!a)
         return;
 
-    for (c = clients; c != sel; c = c->next)
-        if (ISVISIBLE(c) && !c->isfloating)
-            last = c;
+    /* app level matching is cached, only titles are checked per window */
+    if (!a->rulesdone)
+        matchapp(a);
 
-    if (!last)
-        return;
+    for (int i = 0; i < a->nrules; i++) {
+        const Rule *r = &rules[a->rules[i]];
 
-    windowschanged = 1;
-    arrange();
+        if (r->title && !strstr(c->info->name, r->title))
+            continue;
+        if (r->tags)
+            c->tags = r->tags;
+        c->isfloating = r->isfloating;
+        break;
+    }
 }
 
 static void
-killclient(const Arg *arg) {
-    if (!sel)
-        return;
+removeapp(App *a) {
+    App **ap;
 
-    /* try graceful close first */
-    AXUIElementRef closebutton = NULL;
-    if (AXUIElementCopyAttributeValue(sel->win, kAXCloseButtonAttribute,
-                                       (CFTypeRef *)&closebutton) == kAXErrorSuccess) {
-        AXUIElementPerformAction(closebutton, kAXPressAction);
-        CFRelease(closebutton);
+    for (ap = &apps; *ap && *ap != a; ap = &(*ap)->next);
+    if (*ap)
+        *ap = a->next;
+
+    if (a->obs) {
+        CFRunLoopRemoveSource(CFRunLoopGetCurrent(),
+                              AXObserverGetRunLoopSource(a->obs), kCFRunLoopDefaultMode);
+        CFRelease(a->obs);
     }
+    if (a->lane)
+        dispatch_release(a->lane);  /* pending writes keep it alive */
+    CFRelease(a->ax);
+    free(a->rules);
+    free(a);
 }
 
 static void
-setmfact(const Arg *arg) {
-    float f = g_mfact + arg->f;
-    if (f < 0.1 || f > 0.9)
-        return;
-    g_mfact = f;
-    windowschanged = 1;
-    arrange();
-}
+observeapp(App *a) {
+    AXObserverRef obs = NULL;
 
-static void
-incnmaster(const Arg *arg) {
-    g_nmaster = MAX(0, g_nmaster + arg->i);
-    windowschanged = 1;
-    arrange();
-}
+    if (backend->createobserver(a->pid, axcallback, &obs) != kAXErrorSuccess)
+        return;
 
-static void
-setlayout(const Arg *arg) {
-    if (arg->i >= 0 && arg->i < LayoutLast)
-        sellay = arg->i;
-    windowschanged = 1;
-    arrange();
-}
+    if (AXObserverAddNotification(obs, a->ax, kAXWindowCreatedNotification, a) != kAXErrorSuccess) {
+        CFRelease(obs);
+        return;
+    }
+    AXObserverAddNotification(obs, a->ax, kAXFocusedWindowChangedNotification, a);
 
-static void
-cyclelayout(const Arg *arg) {
-    sellay = (sellay + 1) % LayoutLast;
-    windowschanged = 1;
-    arrange();
+    CFRunLoopAddSource(CFRunLoopGetCurrent(),
+                       AXObserverGetRunLoopSource(obs), kCFRunLoopDefaultMode);
+    a->obs = obs;
 }
 
 static void
-togglefloat(const Arg *arg) {
-    if (!sel)
+observewindow(Client *c, int on) {
+    CFStringRef notifications[] = {
+        kAXUIElementDestroyedNotification,
+        kAXWindowMovedNotification,
+        kAXWindowResizedNotification,
+        kAXWindowMiniaturizedNotification,
+        kAXWindowDeminiaturizedNotification,
+        kAXTitleChangedNotification,
+    };
+    App *a = on ? getapp(c->pid) : findapp(c->pid);
+
+    if (!a || !a->obs)
         return;
-    sel->isfloating = !sel->isfloating;
-    windowschanged = 1;
-    arrange();
-    savestate();  /* save window state after float toggle */
+
+    for (size_t i = 0; i < LENGTH(notifications); i++) {
+        if (on)
+            AXObserverAddNotification(a->obs, c->info->win, notifications[i], a);
+        else
+            AXObserverRemoveNotification(a->obs, c->info->win, notifications[i]);
+    }
 }
 
 static void
-view(const Arg *arg) {
-    unsigned int newtags = arg->ui & TAGMASK;
-
-    /* find which monitor owns this workspace */
-    Monitor *m = getmonitorbytags(newtags);
-
-    /* check if this monitor is already viewing this tag */
-    if (m->tagset[m->seltags] == newtags)
-        return;
-
-    /* switch this monitor's view */
-    m->seltags ^= 1;
-    m->tagset[m->seltags] = newtags;
-
+axcallback(AXObserverRef obs, AXUIElementRef el, CFStringRef notification, void *ctx) {
+    App *a = ctx;
+    Client *c = wintoclient(el);
+
+    if (CFEqual(notification, kAXWindowCreatedNotification)
+    || CFEqual(notification, kAXWindowDeminiaturizedNotification)) {
+        if (c && c->hidden == HiddenMinimized) {
+            /* one we parked, restored from the Dock by the user, bring its
+             * tag into view */
+            Arg arg = { .ui = c->tags };
+            c->hidden = Shown;
+            view(&arg);
+            focus(c);
+        } else if (!c && canmanage(el, a->pid)) {
 #ifdef DEBUG
-    printf("mwm: switching monitor %d to tag %u\n",
-           (int)(m - monitors), newtags);
-    fflush(stdout);
+            printf("mwm: window created for pid %d\n", a->pid);
+            fflush(stdout);
 #endif
-
-    windowschanged = 1;
-    arrange();
-
-    /* focus first visible client on this monitor */
-    Client *c;
-    for (c = clients; c; c = c->next) {
-        if (ISVISIBLE(c) && (c->tags & m->tags)) {
-            focus(c);
-            return;
+            manage(el, a->pid);
+            requestarrange();
         }
+        return;
     }
-}
 
-static void
-toggleview(const Arg *arg) {
-    unsigned int newtags = arg->ui & TAGMASK;
+    if (CFEqual(notification, kAXFocusedWindowChangedNotification)) {
+        if (a->pid == frontpid)
+            setfocused(c);
+        return;
+    }
 
-    /* find which monitor owns this workspace */
-    Monitor *m = getmonitorbytags(newtags);
+    if (!c)
+        return;
 
-    unsigned int newtagset = m->tagset[m->seltags] ^ newtags;
-    if (newtagset && (newtagset & m->tags)) {
-        m->tagset[m->seltags] = newtagset;
-        windowschanged = 1;
-        arrange();
+    if (CFEqual(notification, kAXUIElementDestroyedNotification)) {
+        unmanage(c);
+        requestarrange();
+    } else if (CFEqual(notification, kAXWindowMiniaturizedNotification)
+           && c->hidden != HiddenMinimized) {
+        /* minimized by the user: let go of it, but keep listening so it
+         * is managed again as soon as it comes back from the Dock */
+        unmanage(c);
+        AXObserverAddNotification(obs, el, kAXWindowDeminiaturizedNotification, a);
+        requestarrange();
+    } else if (CFEqual(notification, kAXWindowMovedNotification)
+           || CFEqual(notification, kAXWindowResizedNotification)) {
+        /* keep the cached geometry in sync with the real window */
+        c->frame = getframe(c->info->win, c->pid);
+        spatialdirty = 1;
+        /* a tiled window moved by hand is put back by the next arrange */
+        if (c->mon && !c->isfloating && !c->hidden
+        && !CGRectEqualToRect(c->frame, c->target))
+            c->mon->layoutsig = 0;
+    } else if (CFEqual(notification, kAXTitleChangedNotification)) {
+        updatetitle(c);
+        if (c == sel)
+            updatestatusbar();
     }
 }
 
 static void
-tag(const Arg *arg) {
-    if (sel && arg->ui & TAGMASK) {
+applaunched(pid_t pid) {
 #ifdef DEBUG
-        printf("mwm: moving window '%s' to tag %u\n", sel->name, arg->ui);
-        fflush(stdout);
+    printf("mwm: app launched, pid %d\n", pid);
+    fflush(stdout);
 #endif
+    /* register observers now so the first window arrives as a notification */
+    getapp(pid);
+    armscan();
+}
 
-        sel->tags = arg->ui & TAGMASK;
-        windowschanged = 1;
-        arrange();
-        savestate();  /* save window state after tag change */
+static void
+appactivated(pid_t pid) {
+    App *a = getapp(pid);
+    AXUIElementRef win = NULL;
+    Client *c = NULL;
 
-        /* focus next visible client */
-        Client *c;
-        for (c = clients; c; c = c->next) {
-            if (ISVISIBLE(c)) {
-                focus(c);
-                break;
-            }
-        }
+    frontpid = pid;
+    if (!a)
+        return;
+    if (copyattr(a->ax, kAXFocusedWindowAttribute, (CFTypeRef *)&win,
+                 RdFocusedWindow, a->pid) == kAXErrorSuccess && win) {
+        c = wintoclient(win);
+        CFRelease(win);
     }
+    setfocused(c);
 }
 
 static void
-tile(void) {
-    Client *c;
-    int gap = gappx;
-
-    /* tile windows on each monitor separately */
-    for (int mon = 0; mon < nmonitors; mon++) {
-        Monitor *m = &monitors[mon];
-        unsigned int n = 0, i = 0;
-        int mx, my, mw, mh;
-        int sx, sy, sw, sh;
+appterminated(pid_t pid) {
+    Client *c, *next;
+    App *a;
+    int n = 0;
 
-        /* count tiled clients on this monitor */
-        for (c = clients; c; c = c->next) {
-            if (ISVISIBLE(c) && !c->isfloating) {
-                /* check if window's tags match this monitor's tags */
-                if (c->tags & m->tags)
-                    n++;
-            }
+    for (c = clients; c; c = next) {
+        next = c->next;
+        if (c->pid == pid) {
+            unmanage(c);
+            n++;
         }
+    }
 
-        if (n == 0)
-            continue;
-
-        /* calculate areas for this monitor */
-        mx = m->rect.origin.x + gap;
-        my = m->rect.origin.y + gap;
-
-        if (n <= (unsigned int)g_nmaster) {
-            /* all in master */
-            mw = m->rect.size.width - 2 * gap;
-            mh = (m->rect.size.height - (n + 1) * gap) / n;
-        } else {
-            /* master + stack */
-            mw = (m->rect.size.width - 3 * gap) * g_mfact;
-            mh = (m->rect.size.height - (g_nmaster + 1) * gap) / g_nmaster;
-            sx = mx + mw + gap;
-            sy = my;
-            sw = m->rect.size.width - mw - 3 * gap;
-            sh = (m->rect.size.height - (n - g_nmaster + 1) * gap) / (n - g_nmaster);
-        }
+    if ((a = findapp(pid)))
+        removeapp(a);
 
-        /* arrange clients on this monitor */
-        for (c = clients; c; c = c->next) {
-            if (!ISVISIBLE(c))
-                continue;
+    if (n)
+        requestarrange();
+}
 
-            if (c->isfloating)
-                continue;
+static void
+detach(Client *c) {
+    if (c->prev)
+        c->prev->next = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    if (c == clients)
+        clients = c->next;
+    c->next = c->prev = NULL;
+}
 
-            /* check if window's tags match this monitor's tags */
-            if (!(c->tags & m->tags))
-                continue;
+static void
+mrulink(Monitor *m, Client *c) {
+    Client *head;
 
-            if (i < (unsigned int)g_nmaster) {
-                /* master area */
-                CGPoint pos = CGPointMake(mx, my + i * (mh + gap));
-                CGSize size = CGSizeMake(n <= (unsigned int)g_nmaster ? mw : mw, mh);
-                movewindow(c->win, pos);
-                resizewindow(c->win, size);
-                c->frame = CGRectMake(pos.x, pos.y, size.width, size.height);
-            } else {
-                /* stack area */
-                CGPoint pos = CGPointMake(sx, sy + (i - g_nmaster) * (sh + gap));
-                CGSize size = CGSizeMake(sw, sh);
-                movewindow(c->win, pos);
-                resizewindow(c->win, size);
-                c->frame = CGRectMake(pos.x, pos.y, size.width, size.height);
-            }
-            i++;
-        }
+    /* move c to the front of m's ring, unless focuslast is walking it
+     * to c; other focus changes during a cycle still count */
+    if (m->mru == c || (cycling && c == cyclesel))
+        return;
+    mruunlink(c);
+    if (!(head = m->mru)) {
+        c->mnext = c->mprev = c;
+    } else {
+        c->mnext = head;
+        c->mprev = head->mprev;
+        head->mprev->mnext = c;
+        head->mprev = c;
     }
+    m->mru = c;
 }
 
 static void
-monocle(void) {
-    Client *c;
-    int gap = gappx;
+mruunlink(Client *c) {
+    if (!c->mnext)
+        return;
+    /* a ring has no owner pointer, but only a head needs one */
+    for (int i = 0; i < nmonitors; i++)
+        if (monitors[i].mru == c)
+            monitors[i].mru = c->mnext == c ? NULL : c->mnext;
+    c->mprev->mnext = c->mnext;
+    c->mnext->mprev = c->mprev;
+    c->mnext = c->mprev = NULL;
+}
 
-    /* maximize windows on each monitor separately */
-    for (int mon = 0; mon < nmonitors; mon++) {
-        Monitor *m = &monitors[mon];
+static void
+mrusplice(Monitor *m, Client *head) {
+    Client *tail;
 
-        for (c = clients; c; c = c->next) {
-            if (!ISVISIBLE(c) || c->isfloating)
-                continue;
+    /* append a whole ring as older than everything in m's */
+    if (!head)
+        return;
+    if (!m->mru) {
+        m->mru = head;
+        return;
+    }
+    tail = head->mprev;
+    m->mru->mprev->mnext = head;
+    head->mprev = m->mru->mprev;
+    tail->mnext = m->mru;
+    m->mru->mprev = tail;
+}
 
-            /* check if window's tags match this monitor's tags */
-            if (!(c->tags & m->tags))
-                continue;
+static Client *
+mrulast(Monitor *m, Client *skip) {
+    Client *c = m->mru;
 
-            CGPoint pos = CGPointMake(m->rect.origin.x + gap, m->rect.origin.y + gap);
-            CGSize size = CGSizeMake(m->rect.size.width - 2 * gap, m->rect.size.height - 2 * gap);
-            movewindow(c->win, pos);
-            resizewindow(c->win, size);
-            c->frame = CGRectMake(pos.x, pos.y, size.width, size.height);
-        }
-    }
+    /* most recent first, the windows in front are nearly always visible */
+    if (!c)
+        return NULL;
+    do {
+        if (c != skip && ISVISIBLE(c) && c->mon == m)
+            return c;
+        c = c->mnext;
+    } while (c != m->mru);
+    return NULL;
 }
 
 static void
-hidewindow(Client *c) {
-    if (!c || !c->win)
+setfocused(Client *c) {
+    /* the user or an app moved focus, follow it instead of fighting it */
+    focused = c;
+    if (!c || c == sel || !ISVISIBLE(c))
         return;
-    /* move window way off screen to "hide" it */
-    CGPoint offscreen = CGPointMake(-10000, -10000);
-    movewindow(c->win, offscreen);
+    sel = c;
+    selmon = c->mon;
+    mrulink(selmon, c);
+    emitclient(EvFocus, c);
+    updatestatusbar();
 }
 
 static void
-arrange(void) {
-    Client *c;
+focus(Client *c) {
+    if (sel != c)
+        emitclient(EvFocus, c);
+    sel = c;
 
-    /* hide non-visible windows first */
-    for (c = clients; c; c = c->next) {
-        if (!ISVISIBLE(c)) {
-            hidewindow(c);
-        }
+    if (!c) {
+        updatestatusbar();
+        return;
     }
+    if (ISVISIBLE(c))
+        selmon = c->mon;
+    mrulink(selmon, c);
 
-    /* apply layout to visible windows */
-    if (layouts[sellay].arrange)
-        layouts[sellay].arrange();
+    /* nothing to tell the window server if it already has focus */
+    if (c == focused) {
+        updatestatusbar();
+        return;
+    }
 
-    /* focus selected */
-    if (sel && ISVISIBLE(sel))
-        focus(sel);
-    else {
-        /* find first visible client to focus */
-        for (c = clients; c; c = c->next) {
-            if (ISVISIBLE(c)) {
-                focus(c);
-                break;
-            }
-        }
+    /* raise and focus the window */
+    uint64_t t = metrics_now();
+    backend->setattr(c->info->win, kAXMainAttribute, kCFBooleanTrue);
+    axrecord(AxMain, c->pid, t);
+    t = metrics_now();
+    backend->setattr(c->info->win, kAXFocusedAttribute, kCFBooleanTrue);
+    axrecord(AxFocused, c->pid, t);
+
+    /* bring app to front */
+    AXUIElementRef app = backend->createapp(c->pid);
+    if (app) {
+        t = metrics_now();
+        backend->setattr(app, kAXFrontmostAttribute, kCFBooleanTrue);
+        axrecord(AxFrontmost, c->pid, t);
+        CFRelease(app);
     }
+    focused = c;
+    frontpid = c->pid;
 
     updatestatusbar();
 }
 
 static void
-spawn(const Arg *arg) {
-    const char **cmd = (const char **)arg->v;
-    if (!cmd || !cmd[0])
+focusnext(const Arg *arg) {
+    Monitor *m;
+
+    if (!sel || !ISVISIBLE(sel))
         return;
 
-#ifdef DEBUG
-    printf("mwm: spawning %s\n", cmd[0]);
-#endif
-    fflush(stdout);
+    /* cycle through the visible clients of sel's monitor */
+    m = sel->mon;
+    if (m->nvis > 1)
+        focus(m->vis[(sel->visidx + 1) % m->nvis]);
+}
 
-    /* use open command for .app bundles */
-    if (strstr(cmd[0], ".app")) {
-        char buf[512];
-        snprintf(buf, sizeof(buf), "open \"%s\"", cmd[0]);
-        int ret = system(buf);
-        if (ret != 0) {
-            fprintf(stderr, "mwm: spawn failed with %d\n", ret);
-        }
+static void
+focusprev(const Arg *arg) {
+    Monitor *m;
+
+    if (!sel || !ISVISIBLE(sel))
+        return;
+
+    m = sel->mon;
+    if (m->nvis > 1)
+        focus(m->vis[(sel->visidx + m->nvis - 1) % m->nvis]);
+}
+
+static Client *
+mrunext(Monitor *m, Client *from) {
+    /* the next older visible client on m, wrapping to the newest */
+    for (Client *c = from->mnext; c != from; c = c->mnext)
+        if (ISVISIBLE(c) && c->mon == m)
+            return c;
+    return NULL;
+}
+
+static void
+focuslast(const Arg *arg) {
+    CFAbsoluteTime fire = CFAbsoluteTimeGetCurrent() + CYCLEDELAY;
+    Client *c;
+
+    /* like Alt-Tab: the first press goes to the previous window, each
+     * further one while the modifier is held goes one older, and the
+     * ring only takes the new order once the cycle ends */
+    if (cycling && sel && sel->mnext)
+        c = mrunext(selmon, sel);
+    else
+        c = mrulast(selmon, sel);
+    if (!c)
+        return;
+    cycling = 1;
+    cyclesel = c;
+    if (!cycletimer) {
+        cycletimer = CFRunLoopTimerCreate(kCFAllocatorDefault, fire,
+                                          1e9, 0, 0, cycletimercallback, NULL);
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), cycletimer, kCFRunLoopCommonModes);
     } else {
-        if (fork() == 0) {
-            setsid();
-            execvp(cmd[0], (char *const *)cmd);
-            die("mwm: execvp %s failed\n", cmd[0]);
-        }
+        CFRunLoopTimerSetNextFireDate(cycletimer, fire);
     }
+    focus(c);
 }
 
 static void
-quit(const Arg *arg) {
-    running = 0;
+endcycle(const Arg *arg) {
+    if (!cycling)
+        return;
+    cycling = 0;
+    cyclesel = NULL;
+    if (cycletimer)
+        CFRunLoopTimerSetNextFireDate(cycletimer, CFAbsoluteTimeGetCurrent() + 1e9);
+    if (sel)
+        mrulink(selmon, sel);
 }
 
 static void
-updateclients(void) {
-    CFArrayRef windowList = CGWindowListCopyWindowInfo(
-        kCGWindowListOptionOnScreenOnly | kCGWindowListExcludeDesktopElements,
-        kCGNullWindowID
-    );
+cycletimercallback(CFRunLoopTimerRef timer, void *info) {
+    /* the release normally ends the cycle from the tap, this catches a
+     * missed one and presses that came without a modifier, from mwm -c */
+    if (CGEventSourceFlagsState(kCGEventSourceStateCombinedSessionState) & CYCLEMODS)
+        CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + CYCLEDELAY);
+    else
+        endcycle(NULL);
+}
 
-    if (!windowList)
-        return;
+static CGFloat
+dirscore(CGRect from, CGRect to, int dir) {
+    int horiz = dir == DirLeft || dir == DirRight;
+    CGFloat d, gap;
+
+    /* how far along the direction, -1 if to is not that way at all */
+    d = horiz ? CGRectGetMidX(to) - CGRectGetMidX(from)
+              : CGRectGetMidY(to) - CGRectGetMidY(from);
+    if (dir == DirLeft || dir == DirUp)
+        d = -d;
+    if (d <= 0)
+        return -1;
+
+    /* plus how far off to the side, 0 while the two line up */
+    if (horiz)
+        gap = MAX(from.origin.y - CGRectGetMaxY(to), to.origin.y - CGRectGetMaxY(from));
+    else
+        gap = MAX(from.origin.x - CGRectGetMaxX(to), to.origin.x - CGRectGetMaxX(from));
+    return d + 2 * MAX(0, gap);
+}
 
-    /* mark all clients as stale */
-    Client *c, *next;
-    for (c = clients; c; c = c->next)
-        c->isfullscreen = -1;  /* using as "stale" marker */
+static int
+spatialcmp(const void *a, const void *b) {
+    CGFloat x = ((const SpatialEntry *)a)->key, y = ((const SpatialEntry *)b)->key;
 
-    CFIndex count = CFArrayGetCount(windowList);
-    for (CFIndex i = 0; i < count; i++) {
-        CFDictionaryRef wininfo = CFArrayGetValueAtIndex(windowList, i);
+    return x < y ? -1 : x > y;
+}
 
-        CFNumberRef pidref = CFDictionaryGetValue(wininfo, kCGWindowOwnerPID);
-        CFNumberRef layerref = CFDictionaryGetValue(wininfo, kCGWindowLayer);
+static void
+updatespatial(void) {
+    int n = 0, total = 0;
+
+    if (visdirty)
+        updatevisible();
+    for (int i = 0; i < nmonitors; i++)
+        total += monitors[i].nvis;
+    if (total > spatialcap) {
+        spatialcap = total * 2;
+        spatial[0] = realloc(spatial[0], spatialcap * sizeof(SpatialEntry));
+        spatial[1] = realloc(spatial[1], spatialcap * sizeof(SpatialEntry));
+        if (!spatial[0] || !spatial[1])
+            die("mwm: cannot allocate memory\n");
+    }
 
-        if (!pidref || !layerref)
-            continue;
+    /* every shown window of every display in one screen-wide index,
+     * rebuilt only after the visible sets or their frames changed */
+    for (int i = 0; i < nmonitors; i++) {
+        for (int k = 0; k < monitors[i].nvis; k++) {
+            Client *c = monitors[i].vis[k];
 
-        pid_t pid;
-        int layer;
-        CFNumberGetValue(pidref, kCFNumberIntType, &pid);
-        CFNumberGetValue(layerref, kCFNumberIntType, &layer);
+            if (c->hidden != Shown)
+                continue;
+            spatial[0][n] = (SpatialEntry){ CGRectGetMidX(c->frame), c };
+            spatial[1][n] = (SpatialEntry){ CGRectGetMidY(c->frame), c };
+            n++;
+        }
+    }
+    qsort(spatial[0], n, sizeof(SpatialEntry), spatialcmp);
+    qsort(spatial[1], n, sizeof(SpatialEntry), spatialcmp);
+    nspatial = n;
+    spatialdirty = 0;
+}
 
-        /* skip non-standard layers */
-        if (layer != 0)
+static Client *
+spatialfind(Client *from, int dir, int tiled) {
+    int horiz = dir == DirLeft || dir == DirRight;
+    int step = dir == DirRight || dir == DirDown ? 1 : -1;
+    SpatialEntry *a;
+    Client *c, *found = NULL;
+    CGFloat k, s, best = INFINITY;
+    int lo = 0, hi;
+
+    if (spatialdirty || visdirty)
+        updatespatial();
+    a = spatial[horiz ? 0 : 1];
+    k = horiz ? CGRectGetMidX(from->frame) : CGRectGetMidY(from->frame);
+
+    /* first entry at or past from's center */
+    for (hi = nspatial; lo < hi;) {
+        int mid = (lo + hi) / 2;
+
+        if (a[mid].key < k)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* walk outwards, once the distance along the axis alone is worse
+     * than the best score nothing further out can win */
+    for (int i = step > 0 ? lo : lo - 1; i >= 0 && i < nspatial; i += step) {
+        if (fabs(a[i].key - k) >= best)
+            break;
+        c = a[i].c;
+        if (c == from || (tiled && c->isfloating))
             continue;
+        if ((s = dirscore(from->frame, c->frame, dir)) > 0 && s < best) {
+            best = s;
+            found = c;
+        }
+    }
+    return found;
+}
 
-        /* get AX element for window */
-        AXUIElementRef app = AXUIElementCreateApplication(pid);
-        if (!app)
+static Monitor *
+dirmon(Monitor *from, int dir) {
+    Monitor *best = NULL;
+    CGFloat s, bestscore = INFINITY;
+
+    for (int i = 0; i < nmonitors; i++) {
+        if (&monitors[i] == from)
             continue;
+        if ((s = dirscore(from->rect, monitors[i].rect, dir)) > 0 && s < bestscore) {
+            bestscore = s;
+            best = &monitors[i];
+        }
+    }
+    return best;
+}
+
+static void
+focusmon(Monitor *m) {
+    Client *c;
+
+    if (!m)
+        return;
+
+    /* focus the window last used there, an empty display is still
+     * selected so layout bindings act on it */
+    if (visdirty)
+        updatevisible();
+    if ((c = mrulast(m, NULL)))
+        focus(c);
+    else if (m->nvis)
+        focus(m->vis[0]);
+    else {
+        selmon = m;
+        updatestatusbar();
+    }
+}
+
+static void
+focusleftmon(const Arg *arg) {
+    focusmon(dirmon(sel && ISVISIBLE(sel) ? sel->mon : selmon, DirLeft));
+}
+
+static void
+focusrightmon(const Arg *arg) {
+    focusmon(dirmon(sel && ISVISIBLE(sel) ? sel->mon : selmon, DirRight));
+}
+
+static void
+focusdir(const Arg *arg) {
+    Client *c;
+
+    /* the nearest window that way on any display, else the display */
+    if (sel && ISVISIBLE(sel) && (c = spatialfind(sel, arg->i, 0)))
+        focus(c);
+    else
+        focusmon(dirmon(sel && ISVISIBLE(sel) ? sel->mon : selmon, arg->i));
+}
+
+static void
+swapdir(const Arg *arg) {
+    Client *c;
+    Monitor *m;
+    unsigned int t;
+
+    if (!sel || sel->isfloating || !ISVISIBLE(sel))
+        return;
+
+    if ((c = spatialfind(sel, arg->i, 1))) {
+        /* across displays the two trade workspaces as well */
+        if (c->mon != sel->mon) {
+            t = c->tags;
+            settags(c, sel->tags);
+            settags(sel, t);
+            savestate();
+        }
+        swapclients(sel, c);
+    } else if ((m = dirmon(sel->mon, arg->i))) {
+        /* nobody to swap with, move onto that display's view */
+        settags(sel, m->tagset[m->seltags]);
+        savestate();
+    } else {
+        return;
+    }
+    requestarrange();
+
+    /* sel may have changed displays */
+    focus(sel);
+}
+
+static void
+swapnext(const Arg *arg) {
+    Monitor *m;
+    int k;
+
+    if (!sel || sel->isfloating || !ISVISIBLE(sel))
+        return;
+
+    /* next tiled client on the same monitor */
+    m = sel->mon;
+    for (k = sel->visidx + 1; k < m->nvis && m->vis[k]->isfloating; k++);
+    if (k == m->nvis)
+        return;
+
+    swapclients(sel, m->vis[k]);
+    requestarrange();
+}
+
+static void
+swapprev(const Arg *arg) {
+    Monitor *m;
+    int k;
+
+    if (!sel || sel->isfloating || !ISVISIBLE(sel))
+        return;
+
+    m = sel->mon;
+    for (k = sel->visidx - 1; k >= 0 && m->vis[k]->isfloating; k--);
+    if (k < 0)
+        return;
+
+    swapclients(sel, m->vis[k]);
+    requestarrange();
+}
+
+static void
+zoom(const Arg *arg) {
+    Monitor *m;
+    Client *first = NULL, *second = NULL, *c;
 
-        CFArrayRef appwindows = NULL;
-        if (AXUIElementCopyAttributeValue(app, kAXWindowsAttribute,
-                                          (CFTypeRef *)&appwindows) != kAXErrorSuccess) {
-            CFRelease(app);
+    if (!sel || sel->isfloating || !ISVISIBLE(sel))
+        return;
+
+    /* first two tiled clients on sel's monitor */
+    m = sel->mon;
+    for (int k = 0; k < m->nvis && !second; k++) {
+        if (m->vis[k]->isfloating)
             continue;
+        if (!first)
+            first = m->vis[k];
+        else
+            second = m->vis[k];
+    }
+
+    /* swap sel with the master, or the master with the next tiled client */
+    c = sel == first ? second : first;
+    if (!c)
+        return;
+
+    swapclients(sel, c);
+    requestarrange();
+}
+
+static void
+swapclients(Client *a, Client *b) {
+    Client *ap, *an, *bp, *bn;
+
+    if (a == b)
+        return;
+    if (b->next == a) {
+        Client *t = a;
+        a = b;
+        b = t;
+    }
+    ap = a->prev;
+    an = a->next;
+    bp = b->prev;
+    bn = b->next;
+
+    /* exchange the two nodes in place, neighbours keep their positions;
+     * either one may be the head or the tail, in either order */
+    if (an == b) {
+        a->prev = b;
+        a->next = bn;
+        b->prev = ap;
+        b->next = a;
+    } else {
+        a->prev = bp;
+        a->next = bn;
+        b->prev = ap;
+        b->next = an;
+        if (bp)
+            bp->next = a;
+        if (an)
+            an->prev = b;
+    }
+    if (ap)
+        ap->next = b;
+    if (bn)
+        bn->prev = a;
+    if (clients == a)
+        clients = b;
+    else if (clients == b)
+        clients = a;
+
+    /* same order change in the monitor's visible set, no rebuild needed;
+     * only their two frames differ in the next layout */
+    int64_t o = a->order;
+    a->order = b->order;
+    b->order = o;
+    if (!visdirty && a->mon && a->mon == b->mon) {
+        int t = a->visidx;
+
+        a->visidx = b->visidx;
+        b->visidx = t;
+        a->mon->vis[a->visidx] = a;
+        b->mon->vis[b->visidx] = b;
+    } else {
+        dirtymon(a->mon);
+        dirtymon(b->mon);
+    }
+}
+
+static void
+killclient(const Arg *arg) {
+    if (!sel)
+        return;
+
+    armscan();
+
+    /* try graceful close first */
+    AXUIElementRef closebutton = NULL;
+    if (copyattr(sel->info->win, kAXCloseButtonAttribute, (CFTypeRef *)&closebutton,
+                 RdCloseButton, sel->pid) == kAXErrorSuccess) {
+        backend->action(closebutton, kAXPressAction);
+        CFRelease(closebutton);
+    }
+}
+
+static void
+setmfact(const Arg *arg) {
+    float f = MFACT(selmon) + arg->f;
+    if (f < 0.1 || f > 0.9)
+        return;
+    MFACT(selmon) = f;
+    emitlayout(selmon);
+    requestarrange();
+}
+
+static void
+incnmaster(const Arg *arg) {
+    NMASTER(selmon) = MAX(0, NMASTER(selmon) + arg->i);
+    emitlayout(selmon);
+    requestarrange();
+}
+
+static void
+setgap(const Arg *arg) {
+    /* .i = 0 resets to gappx */
+    GAP(selmon) = arg->i ? MAX(0, GAP(selmon) + arg->i) : (int)gappx;
+    emitlayout(selmon);
+    requestarrange();
+}
+
+static void
+setlayout(const Arg *arg) {
+    if (arg->i >= 0 && arg->i < LayoutLast)
+        LAYOUT(selmon) = arg->i;
+    emitlayout(selmon);
+    requestarrange();
+}
+
+static void
+cyclelayout(const Arg *arg) {
+    LAYOUT(selmon) = (LAYOUT(selmon) + 1) % LayoutLast;
+    emitlayout(selmon);
+    requestarrange();
+}
+
+static int
+scratchmatch(const Scratchpad *s, Client *c) {
+    App *a = c->app;
+
+    /* like rules: app name substring or exact bundle id, title substring */
+    if (!a || !((a->name[0] && strstr(a->name, s->app)) || !strcmp(a->bundle, s->app)))
+        return 0;
+    return !s->title || strstr(c->info->name, s->title);
+}
+
+static void
+claimscratch(Client *c, unsigned int i) {
+    /* stays managed and floating, with no tags it is never visible */
+    scratchclients[i] = c;
+    scratchpending[i] = 0;
+    scratchplaced[i] = 0;
+    c->scratch = i + 1;
+    c->isfloating = 1;
+    settags(c, 0);
+}
+
+static void
+showscratch(Client *c) {
+    unsigned int i = c->scratch - 1;
+    const Scratchpad *s = &scratchpads[i];
+    Monitor *m = selmon;
+    CGRect r = CGRectMake(m->rect.origin.x + s->x * m->rect.size.width,
+                          m->rect.origin.y + s->y * m->rect.size.height,
+                          s->w * m->rect.size.width, s->h * m->rect.size.height);
+
+    /* back where it was left, sethidden() moves it there in one write;
+     * the first time and on another display it gets the configured frame */
+    if (c->hidden == HiddenOffscreen) {
+        if (!scratchplaced[i] || !CGRectIntersectsRect(c->restore, m->rect))
+            c->restore = r;
+    } else {
+        settarget(c, r);
+    }
+    scratchplaced[i] = 1;
+
+    settags(c, m->tagset[m->seltags]);
+    requestarrange();
+    focus(c);
+}
+
+static void
+hidescratch(Client *c) {
+    settags(c, 0);
+    requestarrange();
+    if (sel == c)
+        focus(mrulast(selmon, c));
+}
+
+static void
+togglescratch(const Arg *arg) {
+    unsigned int i = arg->ui;
+    Client *c;
+
+    if (i >= LENGTH(scratchpads))
+        return;
+
+    /* adopt a window that turned up while the scratchpad had one, or
+     * start it and show its window as soon as manage() sees it */
+    if (!(c = scratchclients[i])) {
+        for (c = clients; c && (c->scratch || !scratchmatch(&scratchpads[i], c)); c = c->next);
+        if (!c) {
+            Arg a = { .v = scratchpads[i].cmd };
+
+            scratchpending[i] = 1;
+            spawn(&a);
+            return;
+        }
+        claimscratch(c, i);
+    }
+
+    /* only this floating window flips, no layout changes */
+    if (ISVISIBLE(c))
+        hidescratch(c);
+    else
+        showscratch(c);
+}
+
+static void
+togglefloat(const Arg *arg) {
+    if (!sel)
+        return;
+    sel->isfloating = !sel->isfloating;
+    requestarrange();
+    savestate();  /* save window state after float toggle */
+}
+
+static void
+togglesticky(const Arg *arg) {
+    if (!sel)
+        return;
+    setsticky(sel, !sel->issticky);
+    requestarrange();
+}
+
+static void
+updatecurtag(Monitor *m) {
+    unsigned int t = m->tagset[m->seltags];
+
+    /* single tag views keep their own layout, mixed views share slot 0 */
+    m->pertag->curtag = (t && !(t & (t - 1))) ? (unsigned int)__builtin_ctz(t) + 1 : 0;
+}
+
+static void
+view(const Arg *arg) {
+    unsigned int newtags = arg->ui & TAGMASK;
+
+    /* find which monitor owns this workspace */
+    Monitor *m = getmonitorbytags(newtags);
+    selmon = m;
+
+    /* check if this monitor is already viewing this tag */
+    if (m->tagset[m->seltags] == newtags)
+        return;
+
+    /* switch this monitor's view */
+    m->seltags ^= 1;
+    m->tagset[m->seltags] = newtags;
+    updatecurtag(m);
+    dirtymon(m);
+    emitview(m);
+
+#ifdef DEBUG
+    printf("mwm: switching monitor %d to tag %u\n",
+           (int)(m - monitors), newtags);
+    fflush(stdout);
+#endif
+
+    requestarrange();
+
+    /* focus first visible client on this monitor */
+    updatevisible();
+    if (m->nvis)
+        focus(m->vis[0]);
+}
+
+static void
+toggleview(const Arg *arg) {
+    unsigned int newtags = arg->ui & TAGMASK;
+
+    /* find which monitor owns this workspace */
+    Monitor *m = getmonitorbytags(newtags);
+
+    unsigned int newtagset = m->tagset[m->seltags] ^ newtags;
+    if (newtagset && (newtagset & m->tags)) {
+        m->tagset[m->seltags] = newtagset;
+        updatecurtag(m);
+        dirtymon(m);
+        emitview(m);
+        requestarrange();
+    }
+}
+
+static void
+tag(const Arg *arg) {
+    Client *c;
+
+    if (sel && arg->ui & TAGMASK) {
+#ifdef DEBUG
+        printf("mwm: moving window '%s' to tag %u\n", sel->info->name, arg->ui);
+        fflush(stdout);
+#endif
+
+        Monitor *m = ISVISIBLE(sel) ? sel->mon : NULL;
+
+        settags(sel, arg->ui & TAGMASK);
+        requestarrange();
+        savestate();  /* save window state after tag change */
+
+        /* focus the window used before it, preferring the monitor it left */
+        updatevisible();
+        if (m && (c = mrulast(m, NULL)))
+            focus(c);
+        else if (m && m->nvis)
+            focus(m->vis[0]);
+        else
+            for (int i = 0; i < nmonitors; i++)
+                if (monitors[i].nvis) {
+                    focus(monitors[i].vis[0]);
+                    break;
+                }
+    }
+}
+
+static void
+arrangemon(Monitor *m) {
+    static Client **tiled = NULL;
+    static CGRect *frames = NULL;
+    static int cap = 0;
+    LayoutParams p = { MFACT(m), NMASTER(m), GAP(m) };
+    int n = 0;
+
+    if (!layouts[LAYOUT(m)].arrange)
+        return;
+
+    /* gather the tiled clients in order, the layout only sees geometry */
+    if (m->nvis > cap) {
+        cap = m->nvis * 2;
+        tiled = realloc(tiled, cap * sizeof(Client *));
+        frames = realloc(frames, cap * sizeof(CGRect));
+        if (!tiled || !frames)
+            die("mwm: cannot allocate memory\n");
+    }
+    for (int k = 0; k < m->nvis; k++)
+        if (!m->vis[k]->isfloating)
+            tiled[n++] = m->vis[k];
+    if (!n)
+        return;
+
+    layouts[LAYOUT(m)].arrange(m->rect, &p, n, frames);
+    for (int k = 0; k < n; k++)
+        settarget(tiled[k], frames[k]);
+}
+
+static void
+settarget(Client *c, CGRect r) {
+    /* layouts only compute geometry, applyframes() talks to the window */
+    c->target = r;
+    c->arranged = 1;
+}
+
+static void
+applyframes(void) {
+    Client *c;
+
+    /* only visible clients can have been laid out */
+    for (int i = 0; i < nmonitors; i++) {
+        for (int k = 0; k < monitors[i].nvis; k++) {
+            c = monitors[i].vis[k];
+            if (!c->arranged)
+                continue;
+            c->arranged = 0;
+
+            /* only touch the components that actually changed */
+            if (!CGRectEqualToRect(c->frame, c->target))
+                spatialdirty = 1;
+            queueframe(c, c->target,
+                       !CGPointEqualToPoint(c->frame.origin, c->target.origin),
+                       !CGSizeEqualToSize(c->frame.size, c->target.size));
+            c->frame = c->target;
         }
+    }
+}
+
+static AXError
+copyattr(AXUIElementRef el, CFStringRef attr, CFTypeRef *value, int rd, pid_t pid) {
+    uint64_t t = metrics_now();
+    AXError err = backend->copyattr(el, attr, value);
+
+    /* reads count like writes, for their attribute and their app */
+    hist_add(&axreadhist[rd], t);
+    hist_add(metrics_pid(pid), t);
+    return err;
+}
+
+static void
+axrecord(int attr, pid_t pid, uint64_t start) {
+    /* every AX write counts for its attribute and its app */
+    hist_add(&axhist[attr], start);
+    hist_add(metrics_pid(pid), start);
+}
+
+static void
+runframeop(void *ctx) {
+    FrameOp *op = ctx;
+
+    uint64_t t;
+
+    if (op->attr) {
+        t = metrics_now();
+        backend->setattr(op->win, op->attr,
+                                     op->value ? kCFBooleanTrue : kCFBooleanFalse);
+        axrecord(op->axattr, op->pid, t);
+    }
+    if (op->move) {
+        t = metrics_now();
+        movewindow(op->win, op->pos);
+        axrecord(AxPosition, op->pid, t);
+    }
+    if (op->resize) {
+        t = metrics_now();
+        resizewindow(op->win, op->size);
+        axrecord(AxSize, op->pid, t);
+    }
+    CFRelease(op->win);
+    free(op);
+}
+
+static FrameOp *
+newop(AXUIElementRef el) {
+    FrameOp *op = calloc(1, sizeof(FrameOp));
+
+    if (!op)
+        die("mwm: cannot allocate memory\n");
+    op->win = el;
+    CFRetain(el);
+    return op;
+}
+
+static void
+queueop(App *a, FrameOp *op) {
+    /* one serial lane per app keeps its writes ordered while
+     * different apps are updated concurrently */
+    if (!a) {
+        runframeop(op);
+        return;
+    }
+    op->pid = a->pid;
+    if (!a->lane)
+        a->lane = dispatch_queue_create("mwm.apply", DISPATCH_QUEUE_SERIAL);
+    if (!applygroup)
+        applygroup = dispatch_group_create();
+    dispatch_group_async_f(applygroup, a->lane, op, runframeop);
+}
+
+static void
+queueframe(Client *c, CGRect r, int move, int resize) {
+    FrameOp *op;
+
+    if (!move && !resize)
+        return;
+
+    op = newop(c->info->win);
+    op->pos = r.origin;
+    op->size = r.size;
+    op->move = move;
+    op->resize = resize;
+    queueop(c->app, op);
+}
+
+static void
+queueattr(App *a, AXUIElementRef el, CFStringRef attr, int value) {
+    FrameOp *op = newop(el);
+
+    op->attr = attr;
+    op->value = value;
+    op->axattr = CFEqual(attr, kAXHiddenAttribute) ? AxHidden : AxMinimized;
+    queueop(a, op);
+}
 
-        CFIndex wcount = CFArrayGetCount(appwindows);
-        for (CFIndex j = 0; j < wcount; j++) {
-            AXUIElementRef win = (AXUIElementRef)CFArrayGetValueAtIndex(appwindows, j);
+static void
+flushframes(void) {
+    if (!applygroup)
+        return;
+
+    /* a hung app only delays its own lane, never the whole WM */
+    if (dispatch_group_wait(applygroup,
+            dispatch_time(DISPATCH_TIME_NOW, (int64_t)applywait * NSEC_PER_MSEC))) {
+#ifdef DEBUG
+        printf("mwm: frame updates still pending after %ums\n", applywait);
+        fflush(stdout);
+#endif
+    }
+}
+
+static void
+sethidden(Client *c, int state) {
+    CGPoint offscreen = CGPointMake(-10000, -10000);
+
+    if (c->hidden == state)
+        return;
 
-            if (!canmanage(win))
+    /* undo the old state */
+    if (c->hidden == HiddenMinimized)
+        queueattr(c->app, c->info->win, kAXMinimizedAttribute, 0);
+    else if (c->hidden == HiddenOffscreen && state == Shown)
+        settarget(c, c->restore);  /* tiled clients get overridden by the layout */
+    else if (c->hidden == HiddenOffscreen) {
+        /* hidden by app or Dock from now on, nothing would bring a
+         * floating client back later, so move it back right away */
+        c->frame.origin = c->restore.origin;
+        queueframe(c, c->frame, 1, 0);
+    }
+
+    /* enter the new one */
+    if (state == HiddenOffscreen) {
+        c->restore = c->frame;
+        c->frame.origin = offscreen;
+        queueframe(c, c->frame, 1, 0);
+    } else if (state == HiddenMinimized) {
+        queueattr(c->app, c->info->win, kAXMinimizedAttribute, 1);
+    }
+
+    c->hidden = state;
+}
+
+static void
+showhide(void) {
+    Client *c;
+    App *a;
+
+    /* whole-app hiding needs to know which apps still show a window */
+    if (hidemode == HideApp) {
+        for (a = apps; a; a = a->next)
+            a->nclients = a->nshown = 0;
+        for (c = clients; c; c = c->next) {
+            /* a hidden scratchpad is parked offscreen, a shown one keeps
+             * its app up like any other window */
+            if (!c->app || (c->scratch && !ISVISIBLE(c)))
                 continue;
+            c->app->nclients++;
+            if (ISVISIBLE(c))
+                c->app->nshown++;
+        }
+        for (a = apps; a; a = a->next) {
+            int hide = a->nclients && !a->nshown;
+            if (hide != a->hidden) {
+                a->hidden = hide;
+                queueattr(a, a->ax, kAXHiddenAttribute, hide);
+            }
+        }
+    }
+
+    /* only clients whose state flips cost an AX call */
+    for (c = clients; c; c = c->next) {
+        int state = Shown;
+
+        if (!ISVISIBLE(c)) {
+            if (c->scratch)
+                state = HiddenOffscreen;  /* one move to toggle, whatever hidemode */
+            else if (hidemode == HideMinimize)
+                state = HiddenMinimized;
+            else if (hidemode == HideApp && c->app && c->app->hidden)
+                state = HiddenApp;
+            else
+                state = HiddenOffscreen;
+        }
+        sethidden(c, state);
+    }
+}
+
+static uint64_t
+sigbits(double v) {
+    uint64_t u;
+
+    /* the exact bits, converting a negative double to uint64_t is undefined */
+    memcpy(&u, &v, sizeof u);
+    return u;
+}
+
+static uint64_t
+layoutsig(Monitor *m) {
+    uint64_t h = 14695981039346656037ULL;  /* FNV-1a */
+
+#define SIGMIX(V) (h = (h ^ (uint64_t)(V)) * 1099511628211ULL)
+    /* everything a layout reads: parameters, area and tiled clients in order */
+    SIGMIX(LAYOUT(m));
+    SIGMIX(NMASTER(m));
+    SIGMIX(GAP(m));
+    SIGMIX(sigbits(MFACT(m)));
+    SIGMIX(sigbits(m->rect.origin.x));
+    SIGMIX(sigbits(m->rect.origin.y));
+    SIGMIX(sigbits(m->rect.size.width));
+    SIGMIX(sigbits(m->rect.size.height));
+    for (int k = 0; k < m->nvis; k++) {
+        if (m->vis[k]->isfloating)
+            continue;
+        SIGMIX((uintptr_t)m->vis[k]);
+        SIGMIX(m->vis[k]->wid);
+    }
+    SIGMIX(m->nvis);
+#undef SIGMIX
+    return h ? h : 1;
+}
+
+static int
+layoutsame(Monitor *m) {
+    const LayoutInputs *l = &m->last;
+    int n = 0;
+
+    /* two inputs may hash alike, so the kept ones decide */
+    if (l->layout != LAYOUT(m) || l->nmaster != NMASTER(m) || l->gap != GAP(m)
+    || l->mfact != MFACT(m) || l->nvis != m->nvis || !CGRectEqualToRect(l->rect, m->rect))
+        return 0;
+    for (int k = 0; k < m->nvis; k++) {
+        Client *c = m->vis[k];
+
+        if (c->isfloating)
+            continue;
+        if (n == l->ntiled || l->tiled[n].c != c || l->tiled[n].wid != c->wid)
+            return 0;
+        n++;
+    }
+    return n == l->ntiled;
+}
+
+static void
+layoutkeep(Monitor *m) {
+    LayoutInputs *l = &m->last;
+
+    if (m->nvis > l->cap) {
+        l->cap = m->nvis * 2;
+        l->tiled = realloc(l->tiled, l->cap * sizeof(LayoutClient));
+        if (!l->tiled)
+            die("mwm: cannot allocate memory\n");
+    }
+    l->layout = LAYOUT(m);
+    l->nmaster = NMASTER(m);
+    l->gap = GAP(m);
+    l->mfact = MFACT(m);
+    l->nvis = m->nvis;
+    l->rect = m->rect;
+    l->ntiled = 0;
+    for (int k = 0; k < m->nvis; k++)
+        if (!m->vis[k]->isfloating)
+            l->tiled[l->ntiled++] = (LayoutClient){ m->vis[k], m->vis[k]->wid };
+}
+
+static void
+arrange(void) {
+    uint64_t t = metrics_now();
+
+    /* hide non-visible windows first */
+    showhide();
+
+    /* recompute only monitors whose layout inputs changed, then apply
+     * only what changed */
+    for (int i = 0; i < nmonitors; i++) {
+        Monitor *m = &monitors[i];
+        uint64_t sig = layoutsig(m);
+
+        if (sig == m->layoutsig && layoutsame(m))
+            continue;
+        m->layoutsig = sig;
+        layoutkeep(m);
+        uint64_t lt = metrics_now();
+        arrangemon(m);
+        hist_add(&layouthist[LAYOUT(m)], lt);
+    }
+    applyframes();
+    flushframes();
+
+    /* sel is kept in sync with the system focus, only pick a new one
+     * when it went away; re-focusing it would steal focus from whatever
+     * the user clicked since */
+    if (!sel || !ISVISIBLE(sel)) {
+        /* find first visible client to focus */
+        for (int i = 0; i < nmonitors; i++) {
+            if (monitors[i].nvis) {
+                focus(monitors[i].vis[0]);
+                break;
+            }
+        }
+    }
+
+    updatestatusbar();
+    savesession();
+    hist_add(&arrangehist, t);
+}
+
+static void
+spawn(const Arg *arg) {
+    const char **cmd = (const char **)arg->v;
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    size_t len;
+    pid_t pid;
+    int err;
+
+    if (!cmd || !cmd[0])
+        return;
+
+#ifdef DEBUG
+    printf("mwm: spawning %s\n", cmd[0]);
+#endif
+    fflush(stdout);
+
+    /* rescan quickly so the new window is tiled as soon as it appears */
+    armscan();
+
+    /* .app bundles go to LaunchServices, which only activates them if
+     * they are already running */
+    len = strlen(cmd[0]);
+    if (len > 4 && !strcmp(cmd[0] + len - 4, ".app")) {
+        if (!workspace_launch(cmd[0], cmd + 1))
+            fprintf(stderr, "mwm: cannot open %s\n", cmd[0]);
+        return;
+    }
+
+    /* no fork of our own, the child gets a session of its own and the
+     * signals mwm ignores or takes over back at their defaults */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    for (size_t i = 0; i < LENGTH(stopsignals); i++)
+        sigaddset(&sigs, stopsignals[i]);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+    if ((err = posix_spawnp(&pid, cmd[0], NULL, &attr, (char *const *)cmd, environ)))
+        fprintf(stderr, "mwm: spawn %s failed: %s\n", cmd[0], strerror(err));
+    posix_spawnattr_destroy(&attr);
+}
+
+static void
+quit(const Arg *arg) {
+    CFRunLoopStop(CFRunLoopGetMain());
+}
+
+static void
+scanapp(App *a) {
+    CFArrayRef appwindows = NULL;
+    Client *c;
+
+    a->scanned = scangen;
+    if (copyattr(a->ax, kAXWindowsAttribute, (CFTypeRef *)&appwindows,
+                 RdWindows, a->pid) != kAXErrorSuccess)
+        return;
+
+    CFIndex wcount = CFArrayGetCount(appwindows);
+    for (CFIndex j = 0; j < wcount; j++) {
+        AXUIElementRef win = (AXUIElementRef)CFArrayGetValueAtIndex(appwindows, j);
+
+        /* check if already managed, windows we minimized stay managed */
+        if ((c = wintoclient(win))) {
+            if (c->hidden == HiddenMinimized || canmanage(win, a->pid))
+                c->isfullscreen = 0;  /* mark as active */
+        } else if (canmanage(win, a->pid)) {
+            manage(win, a->pid);
+        }
+    }
+
+    CFRelease(appwindows);
+}
+
+static void
+updateclients(void) {
+    uint64_t t = metrics_now();
+    CFArrayRef windowList = backend->windowlist();
+
+    /* a window server call, not an app's, so no per-pid entry */
+    hist_add(&axreadhist[RdWindowList], t);
+
+    if (!windowList)
+        return;
+
+    /* mark all clients as stale */
+    Client *c, *next;
+    for (c = clients; c; c = c->next)
+        c->isfullscreen = -1;  /* using as "stale" marker */
+
+    scangen++;
+
+    CFIndex count = CFArrayGetCount(windowList);
+    for (CFIndex i = 0; i < count; i++) {
+        CFDictionaryRef wininfo = CFArrayGetValueAtIndex(windowList, i);
+
+        CFNumberRef pidref = CFDictionaryGetValue(wininfo, kCGWindowOwnerPID);
+        CFNumberRef layerref = CFDictionaryGetValue(wininfo, kCGWindowLayer);
+
+        if (!pidref || !layerref)
+            continue;
 
-            /* check if already managed */
-            int found = 0;
-            for (c = clients; c; c = c->next) {
-                if (c->pid == pid) {
-                    CGRect f1 = getframe(win);
-                    CGRect f2 = getframe(c->win);
-                    if (CGRectEqualToRect(f1, f2)) {
-                        c->isfullscreen = 0;  /* mark as active */
-                        found = 1;
-                        break;
-                    }
-                }
-            }
+        pid_t pid;
+        int layer;
+        CFNumberGetValue(pidref, kCFNumberIntType, &pid);
+        CFNumberGetValue(layerref, kCFNumberIntType, &layer);
 
-            if (!found)
-                manage(win, pid);
-        }
+        /* skip non-standard layers */
+        if (layer != 0)
+            continue;
 
-        CFRelease(appwindows);
-        CFRelease(app);
+        /* each app's window list is fetched once per pass, however
+         * many on-screen windows it owns */
+        App *app = getapp(pid);
+        if (app && app->scanned != scangen)
+            scanapp(app);
     }
 
+    /* windows parked by minimizing or hiding their app are not on
+     * screen, visit their apps too so they are not dropped */
+    for (c = clients; c; c = c->next)
+        if (c->hidden != Shown && c->app && c->app->scanned != scangen)
+            scanapp(c->app);
+
     CFRelease(windowList);
 
     /* remove stale clients */
@@ -943,30 +2841,57 @@ updateclients(void) {
     }
 }
 
-static void
+static int
 scan(void) {
     int oldcount = 0, newcount = 0;
     Client *c;
 
+    uint64_t t;
+
     /* count current clients */
     for (c = clients; c; c = c->next)
         oldcount++;
 
+    t = metrics_now();
     updateclients();
+    hist_add(&scanhist, t);
 
     /* count after update */
     for (c = clients; c; c = c->next)
         newcount++;
 
-    /* only arrange if window count changed or flag set */
-    if (oldcount != newcount || windowschanged) {
+    /* only arrange if window count changed */
+    if (oldcount != newcount) {
 #ifdef DEBUG
         printf("mwm: windows changed (%d -> %d), re-arranging\n", oldcount, newcount);
         fflush(stdout);
 #endif
-        arrange();
-        windowschanged = 0;
+        requestarrange();
+        return 1;
     }
+    return 0;
+}
+
+static void
+armscan(void) {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    scanfastuntil = now + scanfast;
+    scandelay = scanmin;
+    if (scantimer)
+        CFRunLoopTimerSetNextFireDate(scantimer, now + scandelay);
+}
+
+static void
+schedulescan(int changed) {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    /* stay fast while things happen, back off exponentially when idle */
+    if (changed || now < scanfastuntil)
+        scandelay = scanmin;
+    else
+        scandelay = MIN(MAX(scandelay, scanmin) * 2, scanmax);
+    CFRunLoopTimerSetNextFireDate(scantimer, now + scandelay);
 }
 
 static CGEventRef
@@ -976,7 +2901,6 @@ eventcallback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *r
 #endif
 
     if (type == kCGEventKeyDown) {
-        CGKeyCode keycode = (CGKeyCode)CGEventGetIntegerValueField(event, kCGKeyboardEventKeycode);
         CGEventFlags flags = CGEventGetFlags(event);
 
         unsigned int mod = 0;
@@ -985,6 +2909,12 @@ eventcallback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *r
         if (flags & kCGEventFlagMaskShift)      mod |= ShiftMask;
         if (flags & kCGEventFlagMaskControl)    mod |= CtrlMask;
 
+        /* plain typing never has a binding, let it through right away */
+        if (!(keymods & (1 << mod)))
+            return event;
+
+        CGKeyCode keycode = (CGKeyCode)CGEventGetIntegerValueField(event, kCGKeyboardEventKeycode);
+
 #ifdef DEBUG
         /* debug: show all key events with Option held */
         if (mod & Mod1) {
@@ -994,15 +2924,21 @@ eventcallback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *r
         }
 #endif
 
-        for (size_t i = 0; i < LENGTH(keys); i++) {
-            if (keys[i].keycode == keycode && keys[i].mod == mod) {
+        if (keycode < NKEYCODES && keymap[keycode][mod]) {
+            const Key *k = &keys[keymap[keycode][mod] - 1];
 #ifdef DEBUG
-                printf("mwm: executing binding for keycode=%d\n", keycode);
-                fflush(stdout);
+            printf("mwm: queueing binding for keycode=%d\n", keycode);
+            fflush(stdout);
 #endif
-                keys[i].func(&keys[i].arg);
-                return NULL;  /* consume event */
-            }
+            /* the action runs later on the main run loop, the tap never waits on AX */
+            enqueue(k->func, &k->arg);
+            return NULL;  /* consume event */
+        }
+    } else if (type == kCGEventFlagsChanged) {
+        /* letting go of the modifiers commits a focuslast cycle */
+        if (cycling && !(CGEventGetFlags(event) & CYCLEMODS)) {
+            Arg arg = {0};
+            enqueue(endcycle, &arg);
         }
     } else if (type == kCGEventTapDisabledByTimeout ||
                type == kCGEventTapDisabledByUserInput) {
@@ -1024,9 +2960,80 @@ eventcallback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *r
     return event;
 }
 
+static int
+enqueue(void (*func)(const Arg *), const Arg *arg) {
+    int ok;
+
+    /* called from the tap thread and the main thread, 0 if full */
+    pthread_mutex_lock(&cmdlock);
+    if ((ok = cmdtail - cmdhead < CMDQUEUESIZE)) {
+        cmdqueue[cmdtail % CMDQUEUESIZE] = (Command){ func, *arg, metrics_now() };
+        cmdtail++;
+    }
+    pthread_mutex_unlock(&cmdlock);
+    if (!ok) {
+        fprintf(stderr, "mwm: command queue full, dropping command\n");
+        return 0;
+    }
+
+    CFRunLoopSourceSignal(cmdsrc);
+    CFRunLoopWakeUp(CFRunLoopGetMain());
+    return 1;
+}
+
+static void
+requestarrange(void) {
+    /* every action and notification in this run loop pass shares one arrange() */
+    arrangepending = 1;
+    CFRunLoopSourceSignal(cmdsrc);
+}
+
+static void
+runcommands(void *info) {
+    Command batch[CMDQUEUESIZE];
+    unsigned int n = 0;
+
+    /* take everything queued since the last pass, key repeat piles up here
+     * while an arrange() is in flight */
+    pthread_mutex_lock(&cmdlock);
+    while (cmdhead != cmdtail)
+        batch[n++] = cmdqueue[cmdhead++ % CMDQUEUESIZE];
+    pthread_mutex_unlock(&cmdlock);
+
+    for (unsigned int i = 0; i < n; i++) {
+        batch[i].func(&batch[i].arg);
+        hist_add(&keyhist, batch[i].queued);  /* key press or socket command to action done */
+    }
+
+    if (arrangepending) {
+        arrangepending = 0;
+        arrange();
+    }
+}
+
+static void *
+tapthreadrun(void *arg) {
+    /* a private run loop so the tap is serviced even while main is busy */
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), rlsrc, kCFRunLoopCommonModes);
+    CGEventTapEnable(evtap, true);
+    CFRunLoopRun();  /* returns once the tap is invalidated in cleanup() */
+    return NULL;
+}
+
 static void
 grabkeys(void) {
-    CGEventMask mask = CGEventMaskBit(kCGEventKeyDown);
+    CGEventMask mask = CGEventMaskBit(kCGEventKeyDown) | CGEventMaskBit(kCGEventFlagsChanged);
+
+    /* index keys[] by (keycode, mod), the first binding wins as before */
+    memset(keymap, 0, sizeof(keymap));
+    keymods = 0;
+    for (size_t i = LENGTH(keys); i > 0; i--) {
+        const Key *k = &keys[i - 1];
+        if (k->keycode >= NKEYCODES || k->mod >= NMODS)
+            continue;
+        keymap[k->keycode][k->mod] = (unsigned short)i;
+        keymods |= 1 << k->mod;
+    }
 
     evtap = CGEventTapCreate(
         kCGSessionEventTap,
@@ -1037,17 +3044,671 @@ grabkeys(void) {
         NULL
     );
 
-    if (!evtap)
-        die("mwm: failed to create event tap. Check accessibility permissions.\n");
+    if (!evtap)
+        die("mwm: failed to create event tap. Check accessibility permissions.\n");
+
+    CFRunLoopSourceContext ctx = { .perform = runcommands };
+    cmdsrc = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &ctx);
+    CFRunLoopAddSource(CFRunLoopGetMain(), cmdsrc, kCFRunLoopCommonModes);
+
+    rlsrc = CFMachPortCreateRunLoopSource(kCFAllocatorDefault, evtap, 0);
+    if (pthread_create(&tapthread, NULL, tapthreadrun, NULL) != 0)
+        die("mwm: cannot start event tap thread\n");
+    tapthreadok = 1;
+}
+
+static void
+writemetrics(FILE *f) {
+    char name[64];
+
+    fprintf(f, "%-28s %8s %9s %9s %9s %9s %9s\n",
+            "span (us)", "count", "mean", "p50", "p90", "p99", "max");
+    hist_print(f, "key to action", &keyhist);
+    hist_print(f, "scan", &scanhist);
+    hist_print(f, "arrange", &arrangehist);
+    for (size_t i = 0; i < LENGTH(layouts); i++) {
+        snprintf(name, sizeof(name), "layout %s", layouts[i].symbol);
+        hist_print(f, name, &layouthist[i]);
+    }
+    for (int i = 0; i < AxLast; i++) {
+        snprintf(name, sizeof(name), "ax %s", axnames[i]);
+        hist_print(f, name, &axhist[i]);
+    }
+    for (int i = 0; i < RdLast; i++) {
+        snprintf(name, sizeof(name), "ax read %s", axreadnames[i]);
+        hist_print(f, name, &axreadhist[i]);
+    }
+    metrics_printpids(f);
+}
+
+static void
+dumpmetrics(void *ctx) {
+    char tmp[] = METRICSFILE ".XXXXXX";
+    int fd = mkstemp(tmp);
+    FILE *f;
+
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+        if (fd >= 0)
+            close(fd);
+        fprintf(stderr, "mwm: cannot write metrics: %s\n", strerror(errno));
+        return;
+    }
+    writemetrics(f);
+    fclose(f);
+
+    if (rename(tmp, METRICSFILE) < 0)
+        unlink(tmp);
+}
+
+static int
+printmetrics(void) {
+    char buf[4096];
+    size_t n;
+    FILE *f;
+    pid_t pid = 0;
+
+    /* ask the running instance for a fresh dump */
+    if (!(f = fopen(PIDFILE, "r")) || fscanf(f, "%d", &pid) != 1 || pid <= 0) {
+        if (f)
+            fclose(f);
+        fprintf(stderr, "mwm: not running\n");
+        return 1;
+    }
+    fclose(f);
+
+    unlink(METRICSFILE);
+    if (kill(pid, SIGUSR1) < 0) {
+        fprintf(stderr, "mwm: cannot signal %d: %s\n", (int)pid, strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i < 100 && access(METRICSFILE, R_OK) < 0; i++)
+        usleep(10000);
+
+    if (!(f = fopen(METRICSFILE, "r"))) {
+        fprintf(stderr, "mwm: no metrics from %d\n", (int)pid);
+        return 1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        fwrite(buf, 1, n, stdout);
+    fclose(f);
+    return 0;
+}
+
+static void
+ipcsetup(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    CFSocketRef s;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "mwm: cannot create control socket: %s\n", strerror(errno));
+        return;
+    }
+    strncpy(addr.sun_path, SOCKFILE, sizeof(addr.sun_path) - 1);
+
+    /* we hold the pid lock, so a leftover socket is stale */
+    unlink(SOCKFILE);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        fprintf(stderr, "mwm: cannot listen on %s: %s\n", SOCKFILE, strerror(errno));
+        close(fd);
+        return;
+    }
+    chmod(SOCKFILE, 0600);
+
+    s = CFSocketCreateWithNative(kCFAllocatorDefault, fd, kCFSocketAcceptCallBack,
+                                 ipcaccept, NULL);
+    if (!s) {
+        close(fd);
+        return;
+    }
+    ipcsock = s;
+    ipcsrc = CFSocketCreateRunLoopSource(kCFAllocatorDefault, s, 0);
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), ipcsrc, kCFRunLoopCommonModes);
+}
+
+static void
+ipcaccept(CFSocketRef s, CFSocketCallBackType type, CFDataRef address,
+          const void *data, void *info) {
+    int fd = *(const CFSocketNativeHandle *)data, on = 1;
+    CFSocketContext ctx = { 0 };
+    Conn *c;
+
+    /* replies never block the WM, what the socket cannot take now is
+     * queued and a client that stops reading is dropped */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+
+    c = calloc(1, sizeof(Conn));
+    if (!c)
+        die("mwm: cannot allocate memory\n");
+    c->fd = fd;
+    ctx.info = c;
+    c->sock = CFSocketCreateWithNative(kCFAllocatorDefault, fd,
+                                       kCFSocketReadCallBack | kCFSocketWriteCallBack,
+                                       ipcread, &ctx);
+    if (!c->sock) {
+        close(fd);
+        free(c);
+        return;
+    }
+    c->src = CFSocketCreateRunLoopSource(kCFAllocatorDefault, c->sock, 0);
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), c->src, kCFRunLoopCommonModes);
+    c->next = conns;
+    conns = c;
+}
+
+static void
+ipcclose(Conn *c) {
+    Conn **pc;
+
+    for (pc = &conns; *pc && *pc != c; pc = &(*pc)->next);
+    if (*pc)
+        *pc = c->next;
+    if (c->events) {
+        submask = 0;
+        for (Conn *o = conns; o; o = o->next)
+            submask |= o->events;
+    }
+    CFRunLoopSourceInvalidate(c->src);
+    CFRelease(c->src);
+    CFSocketInvalidate(c->sock);  /* closes the fd */
+    CFRelease(c->sock);
+    free(c->out);
+    free(c);
+}
+
+static void
+ipcwrite(Conn *c, const char *s, size_t len) {
+    /* straight to the socket while nothing is queued, keeping the order */
+    while (!c->dead && !c->outlen && len) {
+        ssize_t n = write(c->fd, s, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            c->dead = 1;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+    if (c->dead || !len)
+        return;
+
+    /* the rest goes out from ipcflush() once the socket drains */
+    if (c->outlen + len > IPCMAXQUEUE) {
+        c->dead = 1;
+        return;
+    }
+    if (c->outlen + len > c->outcap) {
+        c->outcap = MAX(c->outcap * 2, c->outlen + len);
+        c->out = realloc(c->out, c->outcap);
+        if (!c->out)
+            die("mwm: cannot allocate memory\n");
+    }
+    memcpy(c->out + c->outlen, s, len);
+    c->outlen += len;
+    CFSocketEnableCallBacks(c->sock, kCFSocketWriteCallBack);
+}
+
+static void
+ipcflush(Conn *c) {
+    size_t off = 0;
+
+    while (!c->dead && off < c->outlen) {
+        ssize_t n = write(c->fd, c->out + off, c->outlen - off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            c->dead = 1;
+        else
+            off += n;
+    }
+    c->outlen -= off;
+    memmove(c->out, c->out + off, c->outlen);
+
+    /* write callbacks are one-shot, ask again while bytes are left */
+    if (c->dead || (c->closing && !c->outlen))
+        ipcclose(c);
+    else if (c->outlen)
+        CFSocketEnableCallBacks(c->sock, kCFSocketWriteCallBack);
+}
+
+static void
+ipcprintf(Conn *c, const char *fmt, ...) {
+    char buf[512];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        ipcwrite(c, buf, MIN((size_t)n, sizeof(buf) - 1));
+}
+
+static void
+ipcjson(Conn *c, cJSON *json) {
+    char *s = cJSON_PrintUnformatted(json);
+
+    cJSON_Delete(json);
+    if (!s)
+        return;
+    ipcwrite(c, s, strlen(s));
+    ipcwrite(c, "\n", 1);
+    free(s);
+}
+
+static void
+ipcstatus(Conn *c, const char *arg) {
+    cJSON *o = cJSON_CreateObject();
+    Monitor *m = selmon;
+
+    if (visdirty)
+        updatevisible();  /* occupied is rebuilt with the visible sets */
+    cJSON_AddNumberToObject(o, "monitor", (int)(m - monitors));
+    cJSON_AddNumberToObject(o, "tags", m->tagset[m->seltags]);
+    cJSON_AddStringToObject(o, "layout", layouts[LAYOUT(m)].symbol);
+    cJSON_AddNumberToObject(o, "mfact", MFACT(m));
+    cJSON_AddNumberToObject(o, "nmaster", NMASTER(m));
+    cJSON_AddNumberToObject(o, "gap", GAP(m));
+    cJSON_AddNumberToObject(o, "occupied", occupied);
+    if (sel) {
+        cJSON_AddNumberToObject(o, "wid", sel->wid);
+        cJSON_AddStringToObject(o, "app", clientapp(sel));
+        cJSON_AddStringToObject(o, "title", sel->info->name);
+    }
+    ipcjson(c, o);
+}
+
+static void
+ipcclients(Conn *c, const char *arg) {
+    cJSON *a = cJSON_CreateArray();
+
+    for (Client *cl = clients; cl; cl = cl->next) {
+        cJSON *o = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(o, "wid", cl->wid);
+        cJSON_AddNumberToObject(o, "pid", cl->pid);
+        cJSON_AddStringToObject(o, "app", clientapp(cl));
+        cJSON_AddStringToObject(o, "title", cl->info->name);
+        cJSON_AddNumberToObject(o, "tags", cl->tags);
+        cJSON_AddBoolToObject(o, "floating", cl->isfloating);
+        cJSON_AddBoolToObject(o, "sticky", cl->issticky);
+        cJSON_AddBoolToObject(o, "focused", cl == sel);
+        cJSON_AddNumberToObject(o, "monitor", ISVISIBLE(cl) ? (int)(cl->mon - monitors) : -1);
+        cJSON_AddItemToArray(a, o);
+    }
+    ipcjson(c, a);
+}
+
+static void
+ipcmonitors(Conn *c, const char *arg) {
+    cJSON *a = cJSON_CreateArray();
+
+    for (int i = 0; i < nmonitors; i++) {
+        Monitor *m = &monitors[i];
+        cJSON *o = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(o, "id", m->id);
+        cJSON_AddNumberToObject(o, "x", m->rect.origin.x);
+        cJSON_AddNumberToObject(o, "y", m->rect.origin.y);
+        cJSON_AddNumberToObject(o, "width", m->rect.size.width);
+        cJSON_AddNumberToObject(o, "height", m->rect.size.height);
+        cJSON_AddNumberToObject(o, "tags", m->tags);
+        cJSON_AddNumberToObject(o, "view", m->tagset[m->seltags]);
+        cJSON_AddStringToObject(o, "layout", layouts[LAYOUT(m)].symbol);
+        cJSON_AddBoolToObject(o, "selected", m == selmon);
+        cJSON_AddItemToArray(a, o);
+    }
+    ipcjson(c, a);
+}
+
+static void
+ipcmetrics(Conn *c, const char *arg) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+
+    if (!f)
+        return;
+    writemetrics(f);
+    fclose(f);
+    ipcwrite(c, buf, len);
+    free(buf);
+}
+
+static void
+ipcsubscribe(Conn *c, const char *arg) {
+    char buf[128], *tok, *p;
+    unsigned int mask = 0;
+
+    /* "subscribe" for everything, or a list like "subscribe focus,view" */
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (p = buf; (tok = strsep(&p, " ,\t")); ) {
+        int i;
+
+        if (!*tok)
+            continue;
+        for (i = 0; i < EvLast && strcmp(tok, evnames[i]); i++);
+        if (i == EvLast) {
+            ipcprintf(c, "error: subscribe: unknown event: %s\n", tok);
+            return;
+        }
+        mask |= 1 << i;
+    }
+    c->events = mask ? mask : (1 << EvLast) - 1;
+    submask |= c->events;
+
+    /* start from the current state, then only changes follow */
+    ipcstatus(c, "");
+}
+
+static void
+emit(int ev, cJSON *o) {
+    char *s;
+    size_t len;
+    Conn *c, *next;
+
+    cJSON_AddStringToObject(o, "event", evnames[ev]);
+    s = cJSON_PrintUnformatted(o);
+    cJSON_Delete(o);
+    if (!s)
+        return;
+
+    /* one serialization for every subscriber */
+    len = strlen(s);
+    s[len++] = '\n';  /* replaces the terminator, s is written by length */
+    for (c = conns; c; c = next) {
+        next = c->next;
+        if (!(c->events & (1 << ev)))
+            continue;
+        ipcwrite(c, s, len);
+        if (c->dead && c != ipccur)
+            ipcclose(c);  /* ipcread() closes the current one itself */
+    }
+    free(s);
+}
+
+static void
+emitclient(int ev, Client *c) {
+    cJSON *o;
+
+    if (!(submask & (1 << ev)))
+        return;
+    o = cJSON_CreateObject();
+    cJSON_AddNumberToObject(o, "wid", c ? c->wid : 0);
+    if (c) {
+        cJSON_AddNumberToObject(o, "pid", c->pid);
+        cJSON_AddStringToObject(o, "app", clientapp(c));
+        cJSON_AddStringToObject(o, "title", c->info->name);
+        cJSON_AddNumberToObject(o, "tags", c->tags);
+        cJSON_AddBoolToObject(o, "floating", c->isfloating);
+        cJSON_AddBoolToObject(o, "sticky", c->issticky);
+    }
+    emit(ev, o);
+}
+
+static void
+emitview(Monitor *m) {
+    cJSON *o;
+
+    if (!(submask & (1 << EvView)))
+        return;
+    o = cJSON_CreateObject();
+    cJSON_AddNumberToObject(o, "monitor", (int)(m - monitors));
+    cJSON_AddNumberToObject(o, "tags", m->tagset[m->seltags]);
+    cJSON_AddStringToObject(o, "layout", layouts[LAYOUT(m)].symbol);
+    emit(EvView, o);
+}
+
+static void
+emitlayout(Monitor *m) {
+    cJSON *o;
+
+    if (!(submask & (1 << EvLayout)))
+        return;
+    o = cJSON_CreateObject();
+    cJSON_AddNumberToObject(o, "monitor", (int)(m - monitors));
+    cJSON_AddNumberToObject(o, "tags", m->tagset[m->seltags]);
+    cJSON_AddStringToObject(o, "layout", layouts[LAYOUT(m)].symbol);
+    cJSON_AddNumberToObject(o, "mfact", MFACT(m));
+    cJSON_AddNumberToObject(o, "nmaster", NMASTER(m));
+    cJSON_AddNumberToObject(o, "gap", GAP(m));
+    emit(EvLayout, o);
+}
+
+static int
+ipcparsearg(int type, const char *s, Arg *arg, const char **err) {
+    static const char *shcmd[] = { "/bin/sh", "-c", NULL, NULL };
+    static const char *dirnames[] = {
+        [DirLeft] = "left", [DirRight] = "right", [DirUp] = "up", [DirDown] = "down",
+    };
+    char *end;
+    long l;
+
+    switch (type) {
+    case ArgNone:
+        return 1;
+    case ArgTag:
+        l = strtol(s, &end, 10);
+        if (end == s || *end || l < 1 || l > (long)LENGTH(tags)) {
+            *err = "expected a tag number";
+            return 0;
+        }
+        arg->ui = 1 << (l - 1);
+        return 1;
+    case ArgInt:
+        arg->i = (int)strtol(s, &end, 10);
+        if (end == s || *end) {
+            *err = "expected an integer";
+            return 0;
+        }
+        return 1;
+    case ArgFloat:
+        arg->f = strtof(s, &end);
+        if (end == s || *end) {
+            *err = "expected a number";
+            return 0;
+        }
+        return 1;
+    case ArgLayout:
+        /* index or symbol, e.g. "setlayout 2" or "setlayout TTT" */
+        l = strtol(s, &end, 10);
+        if (end != s && !*end && l >= 0 && l < LayoutLast) {
+            arg->i = (int)l;
+            return 1;
+        }
+        for (int i = 0; i < LayoutLast; i++) {
+            if (!strcmp(s, layouts[i].symbol)) {
+                arg->i = i;
+                return 1;
+            }
+        }
+        *err = "unknown layout";
+        return 0;
+    case ArgDir:
+        for (int i = 0; i < (int)LENGTH(dirnames); i++) {
+            if (!strcmp(s, dirnames[i])) {
+                arg->i = i;
+                return 1;
+            }
+        }
+        *err = "expected left, right, up or down";
+        return 0;
+    case ArgShell:
+        if (!*s) {
+            *err = "expected a command";
+            return 0;
+        }
+        shcmd[2] = s;  /* spawn() is done with it before we return */
+        arg->v = shcmd;
+        return 1;
+    }
+    return 0;
+}
+
+static void
+ipcexec(Conn *c, char *line) {
+    const char *err = NULL;
+    char *name, *arg;
+    Arg a = { 0 };
+    size_t i;
+
+    /* one command: name and an optional argument, surrounding blanks ignored */
+    while (*line == ' ' || *line == '\t')
+        line++;
+    for (arg = line + strlen(line); arg > line && (arg[-1] == ' ' || arg[-1] == '\t' || arg[-1] == '\r'); arg--);
+    *arg = '\0';
+    if (!*line)
+        return;
+    name = line;
+    arg = strpbrk(line, " \t");
+    if (arg) {
+        *arg++ = '\0';
+        while (*arg == ' ' || *arg == '\t')
+            arg++;
+    } else {
+        arg = "";
+    }
+
+    for (i = 0; i < LENGTH(ipcqueries); i++) {
+        if (!strcmp(name, ipcqueries[i].name)) {
+            runcommands(NULL);  /* answered after the commands sent before it */
+            ipcqueries[i].func(c, arg);
+            return;
+        }
+    }
+    for (i = 0; i < LENGTH(ipccommands); i++) {
+        if (strcmp(name, ipccommands[i].name))
+            continue;
+        /* in order with the key bindings, spawn right away as its
+         * command line only lives in the read buffer */
+        if (!ipcparsearg(ipccommands[i].type, arg, &a, &err))
+            ipcprintf(c, "error: %s: %s\n", name, err);
+        else if (ipccommands[i].type == ArgShell)
+            ipccommands[i].func(&a);
+        else if (!enqueue(ipccommands[i].func, &a))
+            ipcprintf(c, "error: busy\n");
+        return;
+    }
+    ipcprintf(c, "error: unknown command: %s\n", name);
+}
+
+static void
+ipcread(CFSocketRef s, CFSocketCallBackType type, CFDataRef address,
+        const void *data, void *info) {
+    Conn *c = info;
+    char *p, *q;
+    ssize_t n;
+    int eof = 0;
+
+    if (type == kCFSocketWriteCallBack) {
+        ipcflush(c);
+        return;
+    }
+    for (;;) {
+        n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+        if (n > 0) {
+            c->len += n;
+            if (c->len == sizeof(c->buf) - 1)
+                break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            eof = 1;
+        break;
+    }
+    c->buf[c->len] = '\0';
+
+    /* every complete command in this read runs now, their arrange()
+     * requests collapse into one pass after this callback */
+    ipccur = c;
+    for (p = c->buf; (q = strpbrk(p, ";\n")); p = q + 1) {
+        *q = '\0';
+        ipcexec(c, p);
+    }
+    if (eof && *p) {
+        ipcexec(c, p);
+        p += strlen(p);
+    }
+    ipccur = NULL;
+    c->len -= p - c->buf;
+    memmove(c->buf, p, c->len);
+
+    if (c->len == sizeof(c->buf) - 1) {
+        ipcprintf(c, "error: command too long\n");
+        eof = 1;
+    }
+    if (c->dead) {
+        ipcclose(c);
+    } else if (eof) {
+        /* a subscriber may half-close its end and just keep reading,
+         * a request/reply client gets the rest of its reply first */
+        CFSocketDisableCallBacks(c->sock, kCFSocketReadCallBack);
+        if (!c->events && c->outlen)
+            c->closing = 1;
+        else if (!c->events)
+            ipcclose(c);
+    }
+}
+
+static int
+ipcclient(int argc, char *argv[]) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char buf[4096];
+    size_t len = 0;
+    ssize_t n;
+    int fd, bol = 1, failed = 0;
+
+    /* all arguments form one request, e.g. mwm -c "view 2; setlayout 1" */
+    for (int i = 0; i < argc; i++) {
+        int w = snprintf(buf + len, sizeof(buf) - len, "%s%s", i ? " " : "", argv[i]);
+        if (w < 0 || (size_t)w >= sizeof(buf) - len - 1) {
+            fprintf(stderr, "mwm: command too long\n");
+            return 1;
+        }
+        len += w;
+    }
+    buf[len++] = '\n';
+
+    strncpy(addr.sun_path, SOCKFILE, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "mwm: cannot connect to %s: %s\n", SOCKFILE, strerror(errno));
+        return 1;
+    }
+    if (write(fd, buf, len) != (ssize_t)len) {
+        fprintf(stderr, "mwm: cannot send command: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);  /* the server answers and closes */
 
-    rlsrc = CFMachPortCreateRunLoopSource(kCFAllocatorDefault, evtap, 0);
-    CFRunLoopAddSource(CFRunLoopGetCurrent(), rlsrc, kCFRunLoopCommonModes);
-    CGEventTapEnable(evtap, true);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (bol && !strncmp(buf + i, "error:", MIN(6, n - i)))
+                failed = 1;
+            bol = buf[i] == '\n';
+        }
+        fwrite(buf, 1, n, stdout);
+    }
+    close(fd);
+    return failed;
 }
 
 static void
-sighandler(int sig) {
-    running = 0;
+sighandler(void *ctx) {
+    /* runs on the main queue, so stopping the loop here is safe */
+    CFRunLoopStop(CFRunLoopGetMain());
 }
 
 static int
@@ -1088,94 +3749,248 @@ releaselock(void) {
     }
 }
 
+static unsigned int
+strhash(const char *str) {
+    unsigned int h = 5381;
+
+    while (*str)
+        h = h * 33 + (unsigned char)*str++;
+    return h;
+}
+
+static StateEntry *
+findstate(const char *appname) {
+    StateEntry *e;
+
+    for (e = statehash[strhash(appname) & (STATEHASHSIZE - 1)]; e; e = e->next)
+        if (!strcmp(e->app, appname))
+            return e;
+    return NULL;
+}
+
+static void
+putstate(const char *appname, unsigned int tags, int floating) {
+    StateEntry *e, **bucket;
+
+    /* first entry per app wins, like the lookup order in the file */
+    if (findstate(appname))
+        return;
+
+    e = calloc(1, sizeof(StateEntry));
+    if (!e)
+        die("mwm: cannot allocate memory\n");
+    snprintf(e->app, sizeof(e->app), "%s", appname);
+    e->tags = tags;
+    e->isfloating = floating;
+
+    bucket = &statehash[strhash(appname) & (STATEHASHSIZE - 1)];
+    e->next = *bucket;
+    *bucket = e;
+}
+
+static void
+clearstate(void) {
+    StateEntry *e, *next;
+
+    for (size_t i = 0; i < STATEHASHSIZE; i++) {
+        for (e = statehash[i]; e; e = next) {
+            next = e->next;
+            free(e);
+        }
+        statehash[i] = NULL;
+    }
+}
+
 static void
-savestate(void) {
+writefile(const char *path, char *data) {
+    char tmp[256];
+
+    /* write a temp file and rename it so readers never see a partial file */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (f) {
+        fprintf(f, "%s", data);
+        if (fclose(f) == 0 && rename(tmp, path) == 0) {
 #ifdef DEBUG
-    printf("mwm: savestate() called\n");
-    fflush(stdout);
+            printf("mwm: state written to %s\n", path);
+            fflush(stdout);
+#endif
+        }
+    } else {
+#ifdef DEBUG
+        printf("mwm: failed to open %s for writing: %s\n", tmp, strerror(errno));
+        fflush(stdout);
 #endif
+    }
+    free(data);
+}
+
+static void
+writestate(void *ctx) {
+    writefile(STATEFILE, ctx);
+}
 
+static void
+writesession(void *ctx) {
+    writefile(SESSIONFILE, ctx);
+}
+
+static char *
+sessionjson(void) {
     cJSON *root = cJSON_CreateObject();
-    cJSON *windows = cJSON_CreateArray();
+    cJSON *mons = cJSON_AddArrayToObject(root, "monitors");
+    cJSON *wins = cJSON_AddArrayToObject(root, "clients");
+    char *s;
+
+    for (int i = 0; i < nmonitors; i++) {
+        Monitor *m = &monitors[i];
+        cJSON *o = cJSON_CreateObject(), *tagset = cJSON_AddArrayToObject(o, "tagset");
+        int n = (int)LENGTH(tags) + 1;
+
+        cJSON_AddNumberToObject(o, "id", m->id);
+        cJSON_AddItemToArray(tagset, cJSON_CreateNumber(m->tagset[0]));
+        cJSON_AddItemToArray(tagset, cJSON_CreateNumber(m->tagset[1]));
+        cJSON_AddNumberToObject(o, "seltags", m->seltags);
+        cJSON_AddItemToObject(o, "lay", cJSON_CreateIntArray(m->pertag->lay, n));
+        cJSON_AddItemToObject(o, "mfact", cJSON_CreateFloatArray(m->pertag->mfact, n));
+        cJSON_AddItemToObject(o, "nmaster", cJSON_CreateIntArray(m->pertag->nmaster, n));
+        cJSON_AddItemToObject(o, "gap", cJSON_CreateIntArray(m->pertag->gap, n));
+        cJSON_AddItemToArray(mons, o);
+    }
+    cJSON_AddNumberToObject(root, "selmon", selmon ? selmon->id : 0);
+    cJSON_AddNumberToObject(root, "sel", sel ? sel->wid : 0);
 
-    /* iterate through all clients and save their state */
+    /* in list order, which is stacking and layout order; scratchpads
+     * are left out, a restarted mwm has not claimed them yet */
     for (Client *c = clients; c; c = c->next) {
-        /* get application name from window */
-        char app[256] = {0};
-        CFStringRef appname = NULL;
-        pid_t pid = c->pid;
-
-        ProcessSerialNumber psn;
-        if (GetProcessForPID(pid, &psn) == noErr) {
-            CopyProcessName(&psn, &appname);
-            if (appname) {
-                CFStringGetCString(appname, app, sizeof(app), kCFStringEncodingUTF8);
-                CFRelease(appname);
+        if (c->scratch)
+            continue;
+        cJSON *o = cJSON_CreateObject();
+        CGRect r = c->hidden == HiddenOffscreen ? c->restore : c->frame;
+        double frame[] = { r.origin.x, r.origin.y, r.size.width, r.size.height };
+
+        cJSON_AddNumberToObject(o, "wid", c->wid);
+        cJSON_AddStringToObject(o, "app", clientapp(c));
+        cJSON_AddStringToObject(o, "title", c->info->name);
+        cJSON_AddNumberToObject(o, "tags", c->tags);
+        cJSON_AddNumberToObject(o, "floating", c->isfloating);
+        cJSON_AddNumberToObject(o, "sticky", c->issticky);
+        cJSON_AddItemToObject(o, "frame", cJSON_CreateDoubleArray(frame, 4));
+        cJSON_AddItemToArray(wins, o);
+    }
+
+    s = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return s;
+}
+
+static void
+flushstate(int sync) {
+    cJSON *root, *windows;
+    StateEntry *e;
+    char *json_str = NULL, *session_str = NULL;
+
+    statefirst = 0;
+    if (statedirty) {
+        statedirty = 0;
+
+        root = cJSON_CreateObject();
+        windows = cJSON_CreateArray();
+        for (size_t i = 0; i < STATEHASHSIZE; i++) {
+            for (e = statehash[i]; e; e = e->next) {
+                cJSON *window = cJSON_CreateObject();
+                cJSON_AddStringToObject(window, "app", e->app);
+                cJSON_AddNumberToObject(window, "tags", e->tags);
+                cJSON_AddNumberToObject(window, "floating", e->isfloating);
+                cJSON_AddItemToArray(windows, window);
             }
         }
+        cJSON_AddItemToObject(root, "windows", windows);
+        json_str = cJSON_Print(root);
+        cJSON_Delete(root);
+    }
+    if (sessiondirty) {
+        sessiondirty = 0;
+        session_str = sessionjson();
+    }
 
-        if (app[0] == '\0')
-            continue;
+    if (!json_str && !session_str)
+        return;
 
-        /* create window entry */
-        cJSON *window = cJSON_CreateObject();
-        cJSON_AddStringToObject(window, "app", app);
-        cJSON_AddNumberToObject(window, "tags", c->tags);
-        cJSON_AddNumberToObject(window, "floating", c->isfloating);
-        cJSON_AddItemToArray(windows, window);
+    /* the serial queue keeps writes in order, sync is used on exit */
+    if (!statequeue)
+        statequeue = dispatch_queue_create("mwm.state", DISPATCH_QUEUE_SERIAL);
+    if (json_str)
+        (sync ? dispatch_sync_f : dispatch_async_f)(statequeue, json_str, writestate);
+    if (session_str)
+        (sync ? dispatch_sync_f : dispatch_async_f)(statequeue, session_str, writesession);
+}
 
-#ifdef DEBUG
-        printf("mwm: saving state for '%s' -> tags=%u, floating=%d\n",
-               app, c->tags, c->isfloating);
-        fflush(stdout);
-#endif
-    }
+static void
+statetimercallback(CFRunLoopTimerRef timer, void *info) {
+    flushstate(0);
+}
 
-    cJSON_AddItemToObject(root, "windows", windows);
+static void
+armstatetimer(void) {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent(), fire;
+
+    /* coalesce bursts of changes into one write, pushed back on every call
+     * but never past STATEMAXDELAY after the first unwritten change */
+    if (!statefirst)
+        statefirst = now;
+    fire = MIN(now + STATEDELAY, statefirst + STATEMAXDELAY);
+    if (!statetimer) {
+        statetimer = CFRunLoopTimerCreate(kCFAllocatorDefault, fire,
+                                          1e9, 0, 0, statetimercallback, NULL);
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), statetimer, kCFRunLoopCommonModes);
+    } else {
+        CFRunLoopTimerSetNextFireDate(statetimer, fire);
+    }
+}
 
-    /* write to file */
-    char *json_str = cJSON_Print(root);
-    if (json_str) {
-        FILE *f = fopen(STATEFILE, "w");
-        if (f) {
-            fprintf(f, "%s", json_str);
-            fclose(f);
+static void
+savestate(void) {
 #ifdef DEBUG
-            printf("mwm: state written to %s\n", STATEFILE);
-            fflush(stdout);
+    printf("mwm: savestate() called\n");
+    fflush(stdout);
 #endif
-        } else {
+
+    /* rebuild the in-memory store from the current clients */
+    clearstate();
+    for (Client *c = clients; c; c = c->next) {
+        const char *app = clientapp(c);
+
+        /* a scratchpad's tags and floating are not its app's */
+        if (app[0] == '\0' || c->scratch)
+            continue;
+
+        putstate(app, c->tags, c->isfloating);
+
 #ifdef DEBUG
-            printf("mwm: failed to open %s for writing: %s\n", STATEFILE, strerror(errno));
-            fflush(stdout);
+        printf("mwm: saving state for '%s' -> tags=%u, floating=%d\n",
+               app, c->tags, c->isfloating);
+        fflush(stdout);
 #endif
-        }
-        free(json_str);
     }
 
-    cJSON_Delete(root);
+    statedirty = 1;
+    armstatetimer();
 }
 
 static void
-loadstate(void) {
-    /* state is loaded on-demand in manage() */
-    /* this function ensures the state file exists */
-    struct stat st;
-    if (stat(STATEFILE, &st) != 0) {
-        /* create empty state file */
-        FILE *f = fopen(STATEFILE, "w");
-        if (f) {
-            fprintf(f, "{\"windows\":[]}\n");
-            fclose(f);
-        }
-    }
+savesession(void) {
+    /* the snapshot is built when the timer fires, every arrange() only
+     * marks it stale, so a crash loses at most the last STATEMAXDELAY */
+    sessiondirty = 1;
+    armstatetimer();
 }
 
-static int
-restorestate(const char *appname, unsigned int *tags, int *floating) {
-    FILE *f = fopen(STATEFILE, "r");
+static cJSON *
+readjson(const char *path) {
+    FILE *f = fopen(path, "r");
     if (!f)
-        return 0;
+        return NULL;
 
     /* read entire file */
     fseek(f, 0, SEEK_END);
@@ -1185,7 +4000,7 @@ restorestate(const char *appname, unsigned int *tags, int *floating) {
     char *json_str = malloc(fsize + 1);
     if (!json_str) {
         fclose(f);
-        return 0;
+        return NULL;
     }
 
     fread(json_str, 1, fsize, f);
@@ -1195,88 +4010,442 @@ restorestate(const char *appname, unsigned int *tags, int *floating) {
     /* parse JSON */
     cJSON *root = cJSON_Parse(json_str);
     free(json_str);
+    return root;
+}
+
+static void
+loadstate(void) {
+    /* parse the state file once, manage() answers from memory */
+    cJSON *root = readjson(STATEFILE);
 
     if (!root)
-        return 0;
+        return;
 
     cJSON *windows = cJSON_GetObjectItem(root, "windows");
-    if (!windows || !cJSON_IsArray(windows)) {
-        cJSON_Delete(root);
+    cJSON *window = NULL;
+    if (windows && cJSON_IsArray(windows)) {
+        cJSON_ArrayForEach(window, windows) {
+            cJSON *app = cJSON_GetObjectItem(window, "app");
+            cJSON *tags_item = cJSON_GetObjectItem(window, "tags");
+            cJSON *floating_item = cJSON_GetObjectItem(window, "floating");
+
+            if (!app || !cJSON_IsString(app))
+                continue;
+            putstate(app->valuestring,
+                     tags_item && cJSON_IsNumber(tags_item) ? (unsigned int)tags_item->valueint : 0,
+                     floating_item && cJSON_IsNumber(floating_item) ? floating_item->valueint : 0);
+        }
+    }
+
+    cJSON_Delete(root);
+}
+
+static int
+restorestate(const char *appname, unsigned int *tags, int *floating) {
+    StateEntry *e = findstate(appname);
+
+    if (!e)
         return 0;
+    *tags = e->tags;
+    *floating = e->isfloating;
+    return 1;
+}
+
+static int
+sessioncmp(const void *a, const void *b) {
+    const SessionEntry *x = a, *y = b;
+
+    return x->wid < y->wid ? -1 : x->wid > y->wid;
+}
+
+static int
+sessionordercmp(const void *a, const void *b) {
+    return ((const SessionEntry *)a)->order - ((const SessionEntry *)b)->order;
+}
+
+static void
+restoremon(Monitor *m, cJSON *o) {
+    cJSON *tagset = cJSON_GetObjectItem(o, "tagset"), *v;
+    cJSON *lay = cJSON_GetObjectItem(o, "lay"), *mfact = cJSON_GetObjectItem(o, "mfact");
+    cJSON *nmaster = cJSON_GetObjectItem(o, "nmaster"), *gap = cJSON_GetObjectItem(o, "gap");
+    Pertag *pt = m->pertag;
+    unsigned int t;
+
+    /* only workspaces the display still owns, assigntags() may have
+     * handed the others to another one */
+    for (int i = 0; i < 2; i++)
+        if (cJSON_IsNumber(v = cJSON_GetArrayItem(tagset, i)) &&
+            (t = (unsigned int)v->valuedouble & m->tags))
+            m->tagset[i] = t;
+    if (cJSON_IsNumber(v = cJSON_GetObjectItem(o, "seltags")))
+        m->seltags = v->valueint & 1;
+
+    /* values are checked like the bindings that change them would */
+    for (int i = 0; i <= (int)LENGTH(tags); i++) {
+        if (cJSON_IsNumber(v = cJSON_GetArrayItem(lay, i)) &&
+            v->valueint >= 0 && v->valueint < (int)LENGTH(layouts))
+            pt->lay[i] = v->valueint;
+        if (cJSON_IsNumber(v = cJSON_GetArrayItem(mfact, i)) &&
+            v->valuedouble >= 0.1 && v->valuedouble <= 0.9)
+            pt->mfact[i] = (float)v->valuedouble;
+        if (cJSON_IsNumber(v = cJSON_GetArrayItem(nmaster, i)) && v->valueint >= 0)
+            pt->nmaster[i] = v->valueint;
+        if (cJSON_IsNumber(v = cJSON_GetArrayItem(gap, i)) && v->valueint >= 0)
+            pt->gap[i] = v->valueint;
     }
+    updatecurtag(m);
+    m->layoutsig = 0;
+}
 
-    /* search for matching app */
-    int found = 0;
-    cJSON *window = NULL;
-    cJSON_ArrayForEach(window, windows) {
-        cJSON *app = cJSON_GetObjectItem(window, "app");
-        if (app && cJSON_IsString(app)) {
-            if (strcmp(app->valuestring, appname) == 0) {
-                cJSON *tags_item = cJSON_GetObjectItem(window, "tags");
-                cJSON *floating_item = cJSON_GetObjectItem(window, "floating");
-
-                if (tags_item && cJSON_IsNumber(tags_item))
-                    *tags = (unsigned int)tags_item->valueint;
-                if (floating_item && cJSON_IsNumber(floating_item))
-                    *floating = floating_item->valueint;
-
-                found = 1;
-                break;
-            }
-        }
+static void
+loadsession(void) {
+    cJSON *root = readjson(SESSIONFILE), *clist, *o, *v;
+
+    if (!root)
+        return;
+
+    /* views and layouts come back right away, displays by id */
+    cJSON_ArrayForEach(o, cJSON_GetObjectItem(root, "monitors")) {
+        if (!cJSON_IsNumber(v = cJSON_GetObjectItem(o, "id")))
+            continue;
+        for (int i = 0; i < nmonitors; i++)
+            if (monitors[i].id == (CGDirectDisplayID)v->valuedouble)
+                restoremon(&monitors[i], o);
+    }
+    if (cJSON_IsNumber(v = cJSON_GetObjectItem(root, "selmon")))
+        for (int i = 0; i < nmonitors; i++)
+            if (monitors[i].id == (CGDirectDisplayID)v->valuedouble)
+                selmon = &monitors[i];
+    if (cJSON_IsNumber(v = cJSON_GetObjectItem(root, "sel")))
+        sessionsel = (CGWindowID)v->valuedouble;
+    dirtyall();
+
+    /* windows wait for the first scan, see matchsession() */
+    clist = cJSON_GetObjectItem(root, "clients");
+    if (cJSON_GetArraySize(clist) > 0) {
+        session = calloc(cJSON_GetArraySize(clist), sizeof(SessionEntry));
+        if (!session)
+            die("mwm: cannot allocate memory\n");
     }
+    cJSON_ArrayForEach(o, clist) {
+        SessionEntry *e = &session[nsession];
+        cJSON *frame = cJSON_GetObjectItem(o, "frame");
 
+        if (!cJSON_IsObject(o))
+            continue;
+        e->order = nsession++;
+        if (cJSON_IsNumber(v = cJSON_GetObjectItem(o, "wid")))
+            e->wid = (CGWindowID)v->valuedouble;
+        if (cJSON_IsString(v = cJSON_GetObjectItem(o, "app")))
+            snprintf(e->app, sizeof(e->app), "%s", v->valuestring);
+        if (cJSON_IsString(v = cJSON_GetObjectItem(o, "title")))
+            snprintf(e->title, sizeof(e->title), "%s", v->valuestring);
+        if (cJSON_IsNumber(v = cJSON_GetObjectItem(o, "tags")))
+            e->tags = (unsigned int)v->valuedouble & TAGMASK;
+        if (cJSON_IsNumber(v = cJSON_GetObjectItem(o, "floating")))
+            e->isfloating = v->valueint;
+        if (cJSON_IsNumber(v = cJSON_GetObjectItem(o, "sticky")))
+            e->issticky = v->valueint;
+        if (cJSON_GetArraySize(frame) == 4)
+            e->frame = CGRectMake(cJSON_GetArrayItem(frame, 0)->valuedouble,
+                                  cJSON_GetArrayItem(frame, 1)->valuedouble,
+                                  cJSON_GetArrayItem(frame, 2)->valuedouble,
+                                  cJSON_GetArrayItem(frame, 3)->valuedouble);
+    }
     cJSON_Delete(root);
-    return found;
+
+    /* sorted by window id, every manage() looks itself up */
+    if (session)
+        qsort(session, nsession, sizeof(SessionEntry), sessioncmp);
+
+#ifdef DEBUG
+    printf("mwm: loaded %d windows from the last session\n", nsession);
+    fflush(stdout);
+#endif
+}
+
+static int
+matchsession(Client *c) {
+    SessionEntry key = { .wid = c->wid }, *e = NULL;
+    const char *app;
+    int onscreen = 0;
+
+    if (!session)
+        return 0;
+
+    /* window ids survive a restart of mwm, app and title have to do
+     * for windows the app has recreated since */
+    if (c->wid)
+        e = bsearch(&key, session, nsession, sizeof(SessionEntry), sessioncmp);
+    if (!e || e->client) {
+        e = NULL;
+        app = clientapp(c);
+        for (int i = 0; i < nsession && !e && app[0]; i++)
+            if (!session[i].client && !strcmp(session[i].app, app) &&
+                !strcmp(session[i].title, c->info->name))
+                e = &session[i];
+    }
+    if (!e)
+        return 0;
+
+    e->client = c;
+    if (e->tags)
+        c->tags = e->tags;
+    c->isfloating = e->isfloating;
+    c->issticky = e->issticky;
+
+    /* after a crash windows of hidden tags are still parked offscreen,
+     * treat them as hidden by us so showing them puts them back */
+    for (int i = 0; i < nmonitors; i++)
+        if (CGRectIntersectsRect(c->frame, monitors[i].rect))
+            onscreen = 1;
+    if (!onscreen && !CGRectIsEmpty(e->frame)) {
+        c->hidden = HiddenOffscreen;
+        c->restore = e->frame;
+    }
+    return 1;
 }
 
 static void
-setupmonitors(void) {
+restoresession(void) {
+    Client *c, *tail, *focusc = NULL;
+
+    if (!session)
+        return;
+
+    /* windows of the last session go back in their old order, after
+     * the ones that are new since */
+    qsort(session, nsession, sizeof(SessionEntry), sessionordercmp);
+    for (int i = 0; i < nsession; i++)
+        if ((c = session[i].client))
+            detach(c);
+    for (tail = clients; tail && tail->next; tail = tail->next);
+    for (int i = 0; i < nsession; i++) {
+        if (!(c = session[i].client))
+            continue;
+        c->prev = tail;
+        if (tail)
+            tail->next = c;
+        else
+            clients = c;
+        tail = c;
+        if (sessionsel && c->wid == sessionsel)
+            focusc = c;
+    }
+    /* the visible sets follow the new list order */
+    headorder = 0;
+    for (c = clients, tail = NULL; c; tail = c, c = c->next)
+        c->order = tail ? tail->order + 1 : 0;
+    dirtyall();
+
+    free(session);
+    session = NULL;
+    nsession = 0;
+
+    /* the first arrange() picks a window if the old one is gone */
+    if (focusc)
+        focus(focusc);
+    requestarrange();
+}
+
+static CGRect
+usablerect(CGDirectDisplayID id) {
+    CGRect r;
+
+    /* the real area left by the menu bar and Dock */
+    if (workspace_usablerect(id, &r) && !CGRectIsEmpty(r))
+        return r;
+
+    /* AppKit does not know the display yet, approximate */
+    r = CGDisplayBounds(id);
+    if (CGDisplayIsMain(id)) {
+        r.origin.y += 25;
+        r.size.height -= 25;
+        r.size.height -= 70;
+    }
+    return r;
+}
+
+static Pertag*
+newpertag(void) {
+    Pertag *pt = calloc(1, sizeof(Pertag));
+
+    if (!pt)
+        die("mwm: cannot allocate memory\n");
+    /* every tag starts with the configured defaults */
+    for (unsigned int i = 0; i <= LENGTH(tags); i++) {
+        pt->lay[i] = 0;
+        pt->mfact[i] = DEFAULT_MFACT;
+        pt->nmaster[i] = DEFAULT_NMASTER;
+        pt->gap[i] = gappx;
+    }
+    return pt;
+}
+
+static int
+displaycmp(const void *a, const void *b) {
+    CGDirectDisplayID da = *(const CGDirectDisplayID *)a, db = *(const CGDirectDisplayID *)b;
+
+    /* main display first, the others left to right */
+    if (CGDisplayIsMain(da) != CGDisplayIsMain(db))
+        return CGDisplayIsMain(da) ? -1 : 1;
+    return CGDisplayBounds(da).origin.x < CGDisplayBounds(db).origin.x ? -1 : 1;
+}
+
+static void
+assigntags(void) {
+    unsigned int t;
+
+    /* tags of displays that are not there go to the last one */
+    for (int i = 0; i < nmonitors; i++)
+        monitors[i].tags = 0;
+    for (t = 0; t < LENGTH(tags); t++)
+        monitors[MAX(0, MIN(tagmon[t], nmonitors - 1))].tags |= 1 << t;
+
+    /* a display the map gives nothing takes the last workspace of the
+     * one with the most */
+    for (int i = 0; i < nmonitors; i++) {
+        Monitor *donor = NULL;
+
+        if (monitors[i].tags)
+            continue;
+        for (int j = 0; j < nmonitors; j++)
+            if (__builtin_popcount(monitors[j].tags) > 1 && (!donor
+            || __builtin_popcount(monitors[j].tags) > __builtin_popcount(donor->tags)))
+                donor = &monitors[j];
+        if (!donor)
+            break;
+        t = 1u << (31 - __builtin_clz(donor->tags));
+        donor->tags &= ~t;
+        monitors[i].tags = t;
+    }
+
+    for (t = 0; t < LENGTH(tags); t++) {
+        tagowner[t] = &monitors[0];
+        for (int i = 0; i < nmonitors; i++)
+            if (monitors[i].tags & (1u << t))
+                tagowner[t] = &monitors[i];
+    }
+
+    for (int i = 0; i < nmonitors; i++) {
+        Monitor *m = &monitors[i];
+
+        /* views keep only workspaces the display still owns, so no tag
+         * is shown twice; new monitors, or ones left with nothing, view
+         * their first workspace */
+        for (int k = 0; k < 2; k++)
+            if (!(m->tagset[k] &= m->tags))
+                m->tagset[k] = m->tags & -m->tags;
+        updatecurtag(m);
+    }
+}
+
+static void
+updatemonitors(void) {
     CGDirectDisplayID displays[32];
     uint32_t count = 0;
+    Monitor *old = monitors, *mons;
+    int nold = nmonitors;
+    CGDirectDisplayID selid = selmon ? selmon->id : 0;
 
     /* get all active displays */
-    if (CGGetActiveDisplayList(32, displays, &count) != kCGErrorSuccess) {
-        die("mwm: cannot get display list\n");
+    if (CGGetActiveDisplayList(32, displays, &count) != kCGErrorSuccess || !count) {
+        if (!old)
+            die("mwm: cannot get display list\n");
+        return;
     }
+    qsort(displays, count, sizeof(CGDirectDisplayID), displaycmp);
 
-    nmonitors = (int)count;
-    monitors = calloc(nmonitors, sizeof(Monitor));
-    if (!monitors) {
+    mons = calloc(count, sizeof(Monitor));
+    if (!mons)
         die("mwm: cannot allocate monitors\n");
-    }
 
-    /* get bounds for each display */
-    for (int i = 0; i < nmonitors; i++) {
-        monitors[i].id = displays[i];
-        monitors[i].rect = CGDisplayBounds(displays[i]);
-
-        /* adjust for menu bar on main display */
-        if (CGDisplayIsMain(displays[i])) {
-            monitors[i].rect.origin.y += 25;
-            monitors[i].rect.size.height -= 25;
-            /* approximate dock height */
-            monitors[i].rect.size.height -= 70;
-            /* main monitor gets workspaces 1-5 */
-            monitors[i].tags = 0b11111;  /* tags 1,2,4,8,16 = workspaces 1-5 */
-            /* start viewing workspace 1 on main monitor */
-            monitors[i].tagset[0] = monitors[i].tagset[1] = 1;
-            monitors[i].seltags = 0;
-        } else {
-            /* secondary monitor gets workspaces 6-9 */
-            monitors[i].tags = 0b111100000;  /* tags 32,64,128,256 = workspaces 6-9 */
-            /* start viewing workspace 6 on secondary monitor */
-            monitors[i].tagset[0] = monitors[i].tagset[1] = 32;
-            monitors[i].seltags = 0;
+    /* surviving displays keep their views, only moved or resized ones
+     * end up with new frames from the next arrange() */
+    for (uint32_t i = 0; i < count; i++) {
+        Monitor *m = &mons[i];
+        CGRect r = usablerect(displays[i]);
+        int j;
+
+        for (j = 0; j < nold && old[j].id != displays[i]; j++);
+        if (j < nold) {
+            *m = old[j];
+            old[j].vis = NULL;  /* now owned by the new array */
+            old[j].pertag = NULL;
+            old[j].last.tiled = NULL;
+            old[j].mru = NULL;
+            old[j].id = 0;
+            m->nvis = 0;  /* c->mon is cleared below, see dirtyall() */
+            if (CGRectEqualToRect(m->rect, r))
+                continue;
         }
+        m->id = displays[i];
+        m->rect = r;
+        m->layoutsig = 0;
+        if (!m->pertag)
+            m->pertag = newpertag();
+
+        printf("mwm: monitor %u: %.0fx%.0f @ (%.0f,%.0f)%s\n",
+               i, r.size.width, r.size.height, r.origin.x, r.origin.y,
+               CGDisplayIsMain(displays[i]) ? " (main)" : "");
+    }
+
+    for (int j = 0; j < nold; j++) {
+        free(old[j].vis);
+        free(old[j].pertag);
+        free(old[j].last.tiled);
+    }
+    /* focus history of removed displays goes to the main one */
+    for (int j = 0; j < nold; j++)
+        mrusplice(&mons[0], old[j].mru);
+    /* nothing may follow c->mon into the freed array before the next
+     * updatevisible(), not even the paths that skip ISVISIBLE() */
+    for (Client *c = clients; c; c = c->next)
+        c->mon = NULL;
+    free(old);
+    monitors = mons;
+    nmonitors = (int)count;
+
+    /* keep the selected monitor if its display survived */
+    selmon = &monitors[0];
+    for (int i = 0; i < nmonitors; i++)
+        if (monitors[i].id == selid)
+            selmon = &monitors[i];
+
+    /* workspaces of removed displays move to the surviving ones */
+    assigntags();
+    dirtyall();
+}
+
+static void
+displaytimercallback(CFRunLoopTimerRef timer, void *info) {
+    updatemonitors();
+    requestarrange();
+}
+
+static void
+displaychanged(CGDirectDisplayID display, CGDisplayChangeSummaryFlags flags, void *info) {
+    if (flags & kCGDisplayBeginConfigurationFlag)
+        return;
 
-        printf("mwm: monitor %d: %.0fx%.0f @ (%.0f,%.0f)%s (tags=%u)\n",
-               i, monitors[i].rect.size.width, monitors[i].rect.size.height,
-               monitors[i].rect.origin.x, monitors[i].rect.origin.y,
-               CGDisplayIsMain(displays[i]) ? " (main)" : "", monitors[i].tags);
+    /* one reconfiguration fires a callback per display, and AppKit needs a
+     * moment to update the usable areas, so rebuild once things settle */
+    if (!displaytimer) {
+        displaytimer = CFRunLoopTimerCreate(kCFAllocatorDefault,
+                                            CFAbsoluteTimeGetCurrent() + DISPLAYDELAY,
+                                            1e9, 0, 0, displaytimercallback, NULL);
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), displaytimer, kCFRunLoopCommonModes);
+    } else {
+        CFRunLoopTimerSetNextFireDate(displaytimer, CFAbsoluteTimeGetCurrent() + DISPLAYDELAY);
     }
 }
 
+static void
+setupmonitors(void) {
+    updatemonitors();
+    CGDisplayRegisterReconfigurationCallback(displaychanged, NULL);
+}
+
 static Monitor*
 getmonitor(CGRect frame) {
     /* find the monitor that contains most of the window */
@@ -1296,14 +4465,10 @@ getmonitor(CGRect frame) {
 }
 
 static Monitor*
-getmonitorbytags(unsigned int tags) {
-    /* find the monitor that owns these tags/workspaces */
-    for (int i = 0; i < nmonitors; i++) {
-        if (tags & monitors[i].tags)
-            return &monitors[i];
-    }
-    /* default to first monitor if no match */
-    return &monitors[0];
+getmonitorbytags(unsigned int t) {
+    /* the display owning the lowest of the tags, first one if none */
+    t &= TAGMASK;
+    return t ? tagowner[__builtin_ctz(t)] : &monitors[0];
 }
 
 static void
@@ -1336,24 +4501,44 @@ setup(void) {
     /* detect all monitors */
     setupmonitors();
 
-    /* initialize state */
-    g_mfact = DEFAULT_MFACT;
-    g_nmaster = DEFAULT_NMASTER;
-    tagset[0] = tagset[1] = 1;
-    sellay = 0;
+    /* build the rule matcher */
+    compilerules();
 
-    /* load saved window state */
+    /* load saved window state, and the last session for the first scan */
     loadstate();
+    loadsession();
 
     /* signal handlers */
-    signal(SIGINT, sighandler);
-    signal(SIGTERM, sighandler);
+    for (size_t i = 0; i < LENGTH(stopsignals); i++) {
+        signal(stopsignals[i], SIG_IGN);  /* delivered through the dispatch source instead */
+        sigsrc[i] = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL,
+                                           stopsignals[i], 0, dispatch_get_main_queue());
+        dispatch_source_set_event_handler_f(sigsrc[i], sighandler);
+        dispatch_resume(sigsrc[i]);
+    }
+
+    /* spawned children are never waited for, the kernel reaps them */
+    signal(SIGCHLD, SIG_IGN);
+
+    /* SIGUSR1 dumps the latency histograms */
+    signal(SIGUSR1, SIG_IGN);
+    metricsrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL,
+                                       SIGUSR1, 0, dispatch_get_main_queue());
+    dispatch_source_set_event_handler_f(metricsrc, dumpmetrics);
+    dispatch_resume(metricsrc);
 
     /* grab keys */
     grabkeys();
 
+    /* accept commands on the control socket */
+    ipcsetup();
+
+    /* watch for app launch/terminate */
+    workspace_init(applaunched, appterminated, appactivated);
+
     /* initialize status bar */
     statusbar_init();
+    updatestatusbar();
 
     printf("mwm: started\n");
 }
@@ -1362,57 +4547,144 @@ static void
 cleanup(void) {
     Client *c, *next;
 
+    /* snapshot the session while windows are still where mwm put them,
+     * together with anything still pending from savestate() */
+    if (statetimer) {
+        CFRunLoopTimerInvalidate(statetimer);
+        CFRelease(statetimer);
+        statetimer = NULL;
+    }
+    sessiondirty = 1;
+    flushstate(1);
+
+    workspace_cleanup();
+
+    /* do not leave parked windows offscreen, minimized or hidden */
+    for (c = clients; c; c = c->next)
+        sethidden(c, Shown);
+    for (c = clients; c; c = c->next)
+        if (c->arranged)
+            queueframe(c, c->target, 1, 1);
+    for (App *a = apps; a; a = a->next)
+        if (a->hidden)
+            queueattr(a, a->ax, kAXHiddenAttribute, 0);
+    flushframes();
+
+    for (size_t i = 0; i < LENGTH(sigsrc); i++) {
+        if (sigsrc[i]) {
+            dispatch_source_cancel(sigsrc[i]);
+            dispatch_release(sigsrc[i]);
+        }
+    }
+    if (metricsrc) {
+        dispatch_source_cancel(metricsrc);
+        dispatch_release(metricsrc);
+    }
+
+    while (conns)
+        ipcclose(conns);
+    if (ipcsock) {
+        CFRunLoopSourceInvalidate(ipcsrc);
+        CFRelease(ipcsrc);
+        CFSocketInvalidate(ipcsock);
+        CFRelease(ipcsock);
+        unlink(SOCKFILE);
+    }
+
     for (c = clients; c; c = next) {
         next = c->next;
-        if (c->win)
-            CFRelease(c->win);
-        free(c);
+        if (c->info->win)
+            CFRelease(c->info->win);
+    }
+    while (slabs) {
+        Slab *s = slabs->next;
+        free(slabs);
+        slabs = s;
     }
 
-    if (rlsrc) {
-        CFRunLoopRemoveSource(CFRunLoopGetCurrent(), rlsrc, kCFRunLoopCommonModes);
+    while (apps)
+        removeapp(apps);
+    if (applygroup)
+        dispatch_release(applygroup);
+
+    if (evtap) {
+        /* invalidating the tap removes its source and ends the tap thread */
+        CGEventTapEnable(evtap, false);
+        CFMachPortInvalidate(evtap);
+        if (tapthreadok)
+            pthread_join(tapthread, NULL);
+        CFRelease(evtap);
+    }
+    if (rlsrc)
         CFRelease(rlsrc);
+    if (cmdsrc) {
+        CFRunLoopSourceInvalidate(cmdsrc);
+        CFRelease(cmdsrc);
     }
-    if (evtap)
-        CFRelease(evtap);
 
-    if (monitors)
+    CGDisplayRemoveReconfigurationCallback(displaychanged, NULL);
+    if (cycletimer) {
+        CFRunLoopTimerInvalidate(cycletimer);
+        CFRelease(cycletimer);
+        cycletimer = NULL;
+    }
+    if (displaytimer) {
+        CFRunLoopTimerInvalidate(displaytimer);
+        CFRelease(displaytimer);
+    }
+    if (monitors) {
+        for (int i = 0; i < nmonitors; i++) {
+            free(monitors[i].vis);
+            free(monitors[i].pertag);
+            free(monitors[i].last.tiled);
+        }
         free(monitors);
+    }
+    free(spatial[0]);
+    free(spatial[1]);
+
+    free(session);
+    clearstate();
+    freerules();
+    if (statequeue)
+        dispatch_release(statequeue);
 
     statusbar_cleanup();
     releaselock();
     printf("mwm: stopped\n");
 }
 
-/* periodic timer callback to scan for windows */
+/* periodic safety-net rescan, window changes normally arrive via axcallback() */
 static void
 timercallback(CFRunLoopTimerRef timer, void *info) {
-    scan();
+    schedulescan(scan());
 }
 
 static void
 run(void) {
-    /* create timer to periodically scan windows */
-    CFRunLoopTimerRef timer = CFRunLoopTimerCreate(
+    /* create timer to reconcile missed notifications, rescheduled
+     * by schedulescan() after every pass */
+    scantimer = CFRunLoopTimerCreate(
         kCFAllocatorDefault,
-        CFAbsoluteTimeGetCurrent(),
-        1.0,  /* scan every second */
+        CFAbsoluteTimeGetCurrent() + scanmax,
+        scanmax,
         0, 0,
         timercallback,
         NULL
     );
-    CFRunLoopAddTimer(CFRunLoopGetCurrent(), timer, kCFRunLoopCommonModes);
+    CFRunLoopAddTimer(CFRunLoopGetCurrent(), scantimer, kCFRunLoopCommonModes);
 
-    /* initial scan */
-    scan();
+    /* initial scan, windows of the last session get their place back
+     * before the first arrange() */
+    schedulescan(scan());
+    restoresession();
 
-    /* main event loop */
-    while (running) {
-        CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, true);
-    }
+    /* main event loop, sleeps until a source fires and returns on quit() or a signal */
+    CFRunLoopRun();
 
-    CFRunLoopTimerInvalidate(timer);
-    CFRelease(timer);
+    CFRunLoopTimerInvalidate(scantimer);
+    CFRelease(scantimer);
+    scantimer = NULL;
 }
 
 int
@@ -1422,8 +4694,12 @@ main(int argc, char *argv[]) {
             printf("mwm-0.1\n");
             return 0;
         }
+        if (!strcmp(argv[1], "-m") || !strcmp(argv[1], "--metrics"))
+            return printmetrics();
+        if (!strcmp(argv[1], "-c") && argc > 2)
+            return ipcclient(argc - 2, argv + 2);
         if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
-            printf("usage: mwm [-v] [-h]\n");
+            printf("usage: mwm [-v] [-h] [-m] [-c command]\n");
             return 0;
         }
     }
@@ -7,11 +7,14 @@
 void statusbar_init(void);
 
 /* Update the status bar display
- * tag: current tag number (1-9)
+ * view: bitmask of the tags shown on the selected monitor
+ * occupied: bitmask of the tags that have windows
  * layout: layout symbol (e.g., "[]=", "[M]", "><>")
  * window: current window name (can be NULL)
+ * Cheap to call often: unchanged state is dropped and changes
+ * are drawn once per run loop pass
  */
-void statusbar_update(int tag, const char *layout, const char *window);
+void statusbar_update(unsigned int view, unsigned int occupied, const char *layout, const char *window);
 
 /* Cleanup the status bar */
 void statusbar_cleanup(void);
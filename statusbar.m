@@ -1,13 +1,65 @@
 /* mwm statusbar - macOS menu bar integration
  *
  * Creates a minimal NSStatusItem in the system menu bar
- * showing current tag and layout mode.
+ * showing occupied tags, the current tag, layout mode and window.
+ *
+ * statusbar_update() only records the state; a run loop observer
+ * redraws once per pass, and only if the state actually changed.
  */
 
 #import <Cocoa/Cocoa.h>
 #include "statusbar.h"
 
+typedef struct {
+    unsigned int view;
+    unsigned int occupied;
+    char layout[16];
+    char window[256];
+} BarState;
+
 static NSStatusItem *statusItem = nil;
+static CFRunLoopObserverRef observer = NULL;
+static BarState drawn, pending;
+static int dirty = 0;
+
+static void draw(void) {
+    @autoreleasepool {
+        NSMutableString *title = [NSMutableString string];
+        NSString *windowStr = [NSString stringWithUTF8String:pending.window];
+
+        /* occupied tags, the viewed ones in brackets: "[1] 3 4" */
+        for (unsigned int i = 0; i < 32; i++) {
+            unsigned int bit = 1u << i;
+            if (!((pending.view | pending.occupied) & bit))
+                continue;
+            if (title.length)
+                [title appendString:@" "];
+            [title appendFormat:(pending.view & bit) ? @"[%u]" : @"%u", i + 1];
+        }
+
+        [title appendFormat:@" %s", pending.layout];
+
+        /* Truncate window name if too long */
+        if (windowStr.length > 20)
+            windowStr = [[windowStr substringToIndex:17] stringByAppendingString:@"..."];
+        if (windowStr.length > 0)
+            [title appendFormat:@" %@", windowStr];
+
+        statusItem.button.title = title;
+    }
+}
+
+static void observercallback(CFRunLoopObserverRef obs, CFRunLoopActivity activity, void *info) {
+    if (!dirty)
+        return;
+    dirty = 0;
+
+    /* changed and changed back within one pass */
+    if (!memcmp(&pending, &drawn, sizeof(BarState)))
+        return;
+    drawn = pending;
+    draw();
+}
 
 void statusbar_init(void) {
     @autoreleasepool {
@@ -23,39 +75,37 @@ void statusbar_init(void) {
 
         /* Set initial title */
         statusItem.button.title = @"mwm";
+
+        /* Redraw at most once per run loop pass, before it sleeps */
+        observer = CFRunLoopObserverCreate(kCFAllocatorDefault, kCFRunLoopBeforeWaiting,
+                                           true, 0, observercallback, NULL);
+        CFRunLoopAddObserver(CFRunLoopGetMain(), observer, kCFRunLoopCommonModes);
     }
 }
 
-void statusbar_update(int tag, const char *layout, const char *window) {
-    if (!statusItem) return;
+void statusbar_update(unsigned int view, unsigned int occupied, const char *layout, const char *window) {
+    BarState s;
 
-    @autoreleasepool {
-        NSString *layoutStr = layout ? [NSString stringWithUTF8String:layout] : @"";
-        NSString *windowStr = @"";
-
-        /* Truncate window name if too long */
-        if (window && strlen(window) > 0) {
-            NSString *fullName = [NSString stringWithUTF8String:window];
-            if (fullName.length > 20) {
-                windowStr = [[fullName substringToIndex:17] stringByAppendingString:@"..."];
-            } else {
-                windowStr = fullName;
-            }
-        }
+    if (!statusItem) return;
 
-        /* Format: [tag] [layout] window */
-        NSString *title;
-        if (windowStr.length > 0) {
-            title = [NSString stringWithFormat:@"%d %@ %@", tag, layoutStr, windowStr];
-        } else {
-            title = [NSString stringWithFormat:@"%d %@", tag, layoutStr];
-        }
+    /* zero filled so whole states compare with memcmp */
+    memset(&s, 0, sizeof(s));
+    s.view = view;
+    s.occupied = occupied;
+    snprintf(s.layout, sizeof(s.layout), "%s", layout ? layout : "");
+    snprintf(s.window, sizeof(s.window), "%s", window ? window : "");
 
-        statusItem.button.title = title;
-    }
+    pending = s;
+    if (memcmp(&pending, &drawn, sizeof(BarState)))
+        dirty = 1;
 }
 
 void statusbar_cleanup(void) {
+    if (observer) {
+        CFRunLoopObserverInvalidate(observer);
+        CFRelease(observer);
+        observer = NULL;
+    }
     if (statusItem) {
         @autoreleasepool {
             [[NSStatusBar systemStatusBar] removeStatusItem:statusItem];
@@ -64,4 +114,3 @@ void statusbar_cleanup(void) {
         }
     }
 }
-
@@ -0,0 +1,17 @@
+/* mwm tests - the normal configuration with rules[] swapped for
+ * patterns that exercise the rule matcher */
+
+#define rules configrules
+#include "../config.h"
+#undef rules
+
+static const Rule rules[] = {
+    /* app                  title       tag     floating */
+    { "he",                 NULL,       1 << 0, 0 },  /* 0: overlaps she and hers */
+    { "she",                NULL,       1 << 1, 0 },  /* 1 */
+    { "hers",               NULL,       1 << 2, 0 },  /* 2 */
+    { "his",                NULL,       1 << 3, 0 },  /* 3 */
+    { "com.example.App",    NULL,       1 << 4, 0 },  /* 4: bundle id */
+    { NULL,                 "Settings", 0,      1 },  /* 5: every app */
+    { "he",                 "Other",    1 << 5, 0 },  /* 6: same pattern as 0 */
+};
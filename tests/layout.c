@@ -0,0 +1,147 @@
+/* mwm tests - layout geometry
+ *
+ * layout.c only computes rectangles, so it is built against
+ * tests/shim instead of the system frameworks and runs on any host.
+ *
+ * usage: layout-test
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../layout.h"
+
+#define LENGTH(X)       (sizeof X / sizeof X[0])
+#define CHECK(X, ...)   do { if (!(X)) { failures++; \
+                            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+                            printf(__VA_ARGS__); printf("\n"); } } while (0)
+#define MAXCELLS        8
+
+typedef struct {
+    const char *name;
+    LayoutFunc func;
+} Case;
+
+static const Case cases[] = {
+    { "tile",           tile },
+    { "grid",           grid },
+    { "dwindle",        dwindle },
+    { "centeredmaster", centeredmaster },
+};
+static const int sizes[] = { 0, 1, 2, 5 };
+static const CGRect area = { { 0, 25 }, { 1440, 875 } };
+static int failures;
+
+static CGFloat
+overlap(CGRect a, CGRect b) {
+    CGFloat w = (a.origin.x + a.size.width < b.origin.x + b.size.width
+                 ? a.origin.x + a.size.width : b.origin.x + b.size.width)
+                - (a.origin.x > b.origin.x ? a.origin.x : b.origin.x);
+    CGFloat h = (a.origin.y + a.size.height < b.origin.y + b.size.height
+                 ? a.origin.y + a.size.height : b.origin.y + b.size.height)
+                - (a.origin.y > b.origin.y ? a.origin.y : b.origin.y);
+
+    return w > 0 && h > 0 ? w * h : 0;
+}
+
+static int
+inside(CGRect c, CGRect r) {
+    return c.size.width > 0 && c.size.height > 0
+        && c.origin.x >= r.origin.x && c.origin.y >= r.origin.y
+        && c.origin.x + c.size.width <= r.origin.x + r.size.width
+        && c.origin.y + c.size.height <= r.origin.y + r.size.height;
+}
+
+/* cells inside the area without overlap, and with no gap they cover it */
+static void
+checktiling(const char *name, const CGRect *out, int n, int gap) {
+    CGRect r = CGRectMake(area.origin.x + gap, area.origin.y + gap,
+                          area.size.width - 2 * gap, area.size.height - 2 * gap);
+    CGFloat covered = 0;
+
+    for (int i = 0; i < n; i++) {
+        CHECK(inside(out[i], r), "%s n=%d gap=%d: cell %d outside the area", name, n, gap, i);
+        covered += out[i].size.width * out[i].size.height;
+        for (int j = 0; j < i; j++)
+            CHECK(overlap(out[i], out[j]) == 0, "%s n=%d gap=%d: cells %d and %d overlap",
+                  name, n, gap, j, i);
+    }
+    if (!gap && n)
+        CHECK(covered == r.size.width * r.size.height, "%s n=%d: cells leave %g uncovered",
+              name, n, r.size.width * r.size.height - covered);
+}
+
+static void
+testtiling(void) {
+    LayoutParams p = { .mfact = 0.55f, .nmaster = 1 };
+    CGRect out[MAXCELLS];
+
+    for (size_t l = 0; l < LENGTH(cases); l++) {
+        for (size_t s = 0; s < LENGTH(sizes); s++) {
+            for (p.gap = 0; p.gap <= 10; p.gap += 10) {
+                memset(out, 0, sizeof(out));
+                cases[l].func(area, &p, sizes[s], out);
+                checktiling(cases[l].name, out, sizes[s], p.gap);
+                for (int i = sizes[s]; i < MAXCELLS; i++)
+                    CHECK(!out[i].size.width, "%s n=%d: wrote past cell %d",
+                          cases[l].name, sizes[s], sizes[s] - 1);
+            }
+        }
+    }
+}
+
+static void
+testgrid(void) {
+    LayoutParams p = { .mfact = 0.55f, .nmaster = 1 };
+    CGRect out[MAXCELLS];
+
+    /* columns run top to bottom, their row counts add up to n */
+    for (size_t s = 0; s < LENGTH(sizes); s++) {
+        int n = sizes[s], rows = 0, cols = 0;
+
+        grid(area, &p, n, out);
+        for (int i = 0; i < n; i++) {
+            if (!i || out[i].origin.x != out[i - 1].origin.x)
+                cols++;
+            rows++;
+        }
+        CHECK(rows == n, "grid n=%d: rows add up to %d", n, rows);
+        CHECK(!n || (cols * cols >= n && (cols - 1) * (cols - 1) < n),
+              "grid n=%d: %d columns, not near square", n, cols);
+    }
+}
+
+static void
+testcenteredmaster(void) {
+    LayoutParams p = { .mfact = 0.55f, .nmaster = 1, .gap = 10 };
+    CGRect want[MAXCELLS], got[MAXCELLS];
+
+    /* with at most one stack client it is plain tile */
+    for (size_t s = 0; s < LENGTH(sizes); s++) {
+        int n = sizes[s];
+
+        for (p.nmaster = n - 1; p.nmaster <= n; p.nmaster++) {
+            if (p.nmaster < 0)
+                continue;
+            memset(want, 0, sizeof(want));
+            memset(got, 0, sizeof(got));
+            tile(area, &p, n, want);
+            centeredmaster(area, &p, n, got);
+            CHECK(!memcmp(want, got, sizeof(want)),
+                  "centeredmaster n=%d nmaster=%d: differs from tile", n, p.nmaster);
+        }
+    }
+}
+
+int
+main(void) {
+    testtiling();
+    testgrid();
+    testcenteredmaster();
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+    else
+        printf("all checks passed\n");
+    return failures != 0;
+}
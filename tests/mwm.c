@@ -0,0 +1,325 @@
+/* mwm tests - rule matching, client list surgery, visible sets and the
+ * layout memo
+ *
+ * Builds mwm.c against tests/config.h, only pure list and string code
+ * is exercised so no windows or permissions are needed.
+ *
+ * usage: mwm-test
+ */
+
+#define CONFIG "tests/config.h"
+#define main mwmmain
+#include "../mwm.c"
+#undef main
+
+static int failures = 0;
+
+#define CHECK(X, ...) do { \
+    if (!(X)) { \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+static void
+checkrules(const char *name, const char *bundle, const int *want, int nwant) {
+    App a = {0};
+
+    snprintf(a.name, sizeof(a.name), "%s", name);
+    snprintf(a.bundle, sizeof(a.bundle), "%s", bundle);
+    matchapp(&a);
+
+    CHECK(a.nrules == nwant, "'%s' '%s': %d rules, want %d", name, bundle, a.nrules, nwant);
+    for (int i = 0; i < a.nrules && i < nwant; i++)
+        CHECK(a.rules[i] == want[i], "'%s' '%s': rule %d is %d, want %d",
+              name, bundle, i, a.rules[i], want[i]);
+    free(a.rules);
+}
+
+static void
+testrules(void) {
+    compilerules();
+
+    /* overlapping patterns all hit in one pass, in config order */
+    checkrules("ushers", "", (int[]){ 0, 1, 2, 5, 6 }, 5);
+    checkrules("she", "", (int[]){ 0, 1, 5, 6 }, 4);
+    checkrules("this", "", (int[]){ 3, 5 }, 2);
+    checkrules("hhhers", "", (int[]){ 0, 2, 5, 6 }, 4);
+
+    /* bundle ids only match exactly, the name still as a substring */
+    checkrules("Example", "com.example.App", (int[]){ 4, 5 }, 2);
+    checkrules("Example", "com.example.Apps", (int[]){ 5 }, 1);
+    checkrules("my com.example.App", "", (int[]){ 4, 5 }, 2);
+
+    /* rules without an app match everything, even unnamed apps */
+    checkrules("", "", (int[]){ 5 }, 1);
+    checkrules("Safari", "com.apple.Safari", (int[]){ 5 }, 1);
+
+    /* and are applied to their windows */
+    App a = {0};
+    ClientInfo info = {0};
+    Client c = { .app = &a, .info = &info };
+    snprintf(info.name, sizeof(info.name), "Settings");
+    applyrules(&c);
+    CHECK(c.isfloating, "app rule 5 not applied to an unnamed app");
+    free(a.rules);
+
+    /* compiling again starts over */
+    compilerules();
+    checkrules("ushers", "", (int[]){ 0, 1, 2, 5, 6 }, 5);
+    freerules();
+}
+
+/* clients[0..n) linked in order, positions swapped by the test */
+static void
+linkclients(Client *c, int n) {
+    clients = n ? &c[0] : NULL;
+    for (int i = 0; i < n; i++) {
+        memset(&c[i], 0, sizeof(Client));
+        c[i].wid = i;
+        c[i].prev = i ? &c[i - 1] : NULL;
+    }
+    for (int i = 0; i < n; i++)
+        c[i].next = i + 1 < n ? &c[i + 1] : NULL;
+}
+
+static void
+checklist(const CGWindowID *want, int n, int i, int j) {
+    Client *c, *prev = NULL;
+    int k = 0;
+
+    for (c = clients; c && k <= n; prev = c, c = c->next, k++) {
+        CHECK(c->prev == prev, "swap(%d,%d) n=%d: bad prev at %d", i, j, n, k);
+        if (k < n)
+            CHECK(c->wid == want[k], "swap(%d,%d) n=%d: %u at %d, want %u",
+                  i, j, n, c->wid, k, want[k]);
+    }
+    CHECK(k == n, "swap(%d,%d) n=%d: list has %d clients", i, j, n, k);
+}
+
+static void
+testswap(void) {
+    Client c[5];
+    CGWindowID want[5];
+
+    /* head, tail, adjacent and apart, both argument orders */
+    for (int n = 1; n <= 5; n++) {
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                linkclients(c, n);
+                swapclients(&c[i], &c[j]);
+                for (int k = 0; k < n; k++)
+                    want[k] = k == i ? j : k == j ? i : k;
+                checklist(want, n, i, j);
+            }
+        }
+    }
+
+    /* the same pair back and forth restores the order */
+    linkclients(c, 5);
+    swapclients(&c[2], &c[0]);
+    swapclients(&c[0], &c[2]);
+    checklist((CGWindowID[]){ 0, 1, 2, 3, 4 }, 5, 2, 0);
+    clients = NULL;
+}
+
+static void
+testcycle(void) {
+    Monitor m = {0};
+    Client c[4] = {0};
+    Client *p;
+    int i;
+
+    /* focused 0, 1, 2, 3 in turn, so the ring reads 3 2 1 0 */
+    visdirty = 0;
+    for (i = 0; i < 4; i++) {
+        c[i].mon = &m;
+        mrulink(&m, &c[i]);
+    }
+
+    /* a focuslast cycle walks older each step and wraps to the newest */
+    cycling = 1;
+    p = &c[3];
+    for (i = 2; i >= -1; i--) {
+        p = mrunext(&m, p);
+        CHECK(p == &c[i < 0 ? 3 : i], "cycle step to %d", i);
+        cyclesel = p;
+        mrulink(&m, p);
+        CHECK(m.mru == &c[3], "ring reordered during a cycle");
+    }
+
+    /* a client off the monitor is skipped */
+    c[2].mon = NULL;
+    CHECK(mrunext(&m, &c[3]) == &c[1], "cycle visited a hidden client");
+
+    /* a window focused some other way during the cycle still moves up */
+    cyclesel = &c[1];
+    mrulink(&m, &c[0]);
+    CHECK(m.mru == &c[0] && c[0].mnext == &c[3], "focus during a cycle lost");
+
+    /* ending the cycle moves the chosen one to the front */
+    cycling = 0;
+    cyclesel = NULL;
+    mrulink(&m, &c[1]);
+    CHECK(m.mru == &c[1] && c[1].mnext == &c[0], "cycle not committed");
+    for (i = 0; i < 4; i++)
+        mruunlink(&c[i]);
+    visdirty = 1;
+}
+
+static void
+checkvisible(int step) {
+    int n[3] = {0};
+
+    /* what one pass over the whole list used to build */
+    updatevisible();
+    for (Client *c = clients; c; c = c->next) {
+        Monitor *m = NULL;
+
+        if (c->issticky && c->tags)
+            m = getmonitorbytags(c->tags);
+        else
+            for (int i = 0; i < nmonitors && !m; i++)
+                if (c->tags & monitors[i].tagset[monitors[i].seltags])
+                    m = &monitors[i];
+        CHECK(c->mon == m, "step %d: client %u on %d, want %d", step, c->wid,
+              c->mon ? (int)(c->mon - monitors) : -1, m ? (int)(m - monitors) : -1);
+        if (!m)
+            continue;
+        int i = (int)(m - monitors);
+        CHECK(n[i] < m->nvis && m->vis[n[i]] == c && c->visidx == n[i],
+              "step %d: client %u not at %d on monitor %d", step, c->wid, n[i], i);
+        n[i]++;
+    }
+    for (int i = 0; i < nmonitors; i++)
+        CHECK(monitors[i].nvis == n[i], "step %d: monitor %d shows %d, want %d",
+              step, i, monitors[i].nvis, n[i]);
+}
+
+static void
+testvisible(void) {
+    static Client c[24];
+    static ClientInfo info[24];
+    Monitor mons[3] = {0};
+    int in[24] = {0};
+
+    /* three displays owning every third tag */
+    monitors = mons;
+    nmonitors = 3;
+    for (unsigned int i = 0; i < LENGTH(tags); i++) {
+        tagowner[i] = &mons[i % 3];
+        mons[i % 3].tags |= 1u << i;
+    }
+    for (int i = 0; i < 3; i++)
+        mons[i].tagset[0] = mons[i].tags & -mons[i].tags;
+    clients = NULL;
+    dirtyall();
+
+    /* random changes against a rebuild from scratch after each one */
+    srand(1);
+    for (int step = 0; step < 20000; step++) {
+        int i = rand() % 24, j = rand() % 24;
+        unsigned int t = rand() % 4 ? 1u << (rand() % LENGTH(tags)) : rand() & TAGMASK;
+
+        switch (rand() % 6) {
+        case 0:
+            if (in[i]) {
+                detach(&c[i]);
+                forget(&c[i]);
+                in[i] = 0;
+            } else {
+                memset(&c[i], 0, sizeof(Client));
+                c[i].info = &info[i];
+                c[i].wid = i;
+                c[i].tags = t;
+                c[i].issticky = rand() % 4 == 0;
+                attach(&c[i]);
+                in[i] = 1;
+            }
+            break;
+        case 1:
+            if (in[i])
+                settags(&c[i], t);
+            break;
+        case 2:
+            if (in[i])
+                setsticky(&c[i], !c[i].issticky);
+            break;
+        case 3:
+            if (in[i] && in[j])
+                swapclients(&c[i], &c[j]);
+            break;
+        default:
+            if ((t &= mons[i % 3].tags)) {
+                mons[i % 3].tagset[mons[i % 3].seltags] = t;
+                dirtymon(&mons[i % 3]);
+            }
+            break;
+        }
+        checkvisible(step);
+        if (failures)
+            break;
+    }
+
+    for (int i = 0; i < 24; i++)
+        if (in[i]) {
+            detach(&c[i]);
+            forget(&c[i]);
+        }
+    for (int i = 0; i < 3; i++)
+        free(mons[i].vis);
+    monitors = NULL;
+    nmonitors = 0;
+    visdirty = 1;
+}
+
+static void
+testlayoutmemo(void) {
+    Monitor m = { .rect = { { 0, 0 }, { 800, 600 } } };
+    Client c[3] = { { .wid = 1 }, { .wid = 2 }, { .wid = 3, .isfloating = 1 } };
+    Client *vis[3] = { &c[0], &c[1], &c[2] };
+
+    m.pertag = newpertag();
+    m.vis = vis;
+    m.nvis = 3;
+    layoutkeep(&m);
+    CHECK(layoutsame(&m), "kept inputs do not match themselves");
+
+    /* each input on its own makes the layout stale */
+    MFACT(&m) += 0.05f;
+    CHECK(!layoutsame(&m), "mfact change not seen");
+    MFACT(&m) -= 0.05f;
+    layoutkeep(&m);
+    vis[0] = &c[1];
+    vis[1] = &c[0];
+    CHECK(!layoutsame(&m), "order change not seen");
+    layoutkeep(&m);
+    c[0].wid = 4;
+    CHECK(!layoutsame(&m), "new window at a reused address not seen");
+    layoutkeep(&m);
+    c[2].isfloating = 0;
+    CHECK(!layoutsame(&m), "floating change not seen");
+    layoutkeep(&m);
+    m.rect.size.width = 1024;
+    CHECK(!layoutsame(&m), "resized monitor not seen");
+
+    free(m.last.tiled);
+    free(m.pertag);
+}
+
+int
+main(void) {
+    testrules();
+    testswap();
+    testcycle();
+    testvisible();
+    testlayoutmemo();
+
+    if (failures)
+        printf("%d checks failed\n", failures);
+    else
+        printf("all checks passed\n");
+    return failures != 0;
+}
@@ -0,0 +1,27 @@
+/* mwm tests - the CoreGraphics geometry layout.c needs, so the layout
+ * test builds and runs on any host */
+
+#ifndef APPLICATIONSERVICES_SHIM_H
+#define APPLICATIONSERVICES_SHIM_H
+
+typedef double CGFloat;
+
+typedef struct {
+    CGFloat x, y;
+} CGPoint;
+
+typedef struct {
+    CGFloat width, height;
+} CGSize;
+
+typedef struct {
+    CGPoint origin;
+    CGSize size;
+} CGRect;
+
+static inline CGRect
+CGRectMake(CGFloat x, CGFloat y, CGFloat width, CGFloat height) {
+    return (CGRect){ { x, y }, { width, height } };
+}
+
+#endif /* APPLICATIONSERVICES_SHIM_H */
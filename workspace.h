@@ -0,0 +1,37 @@
+/* mwm workspace - NSWorkspace and NSScreen integration */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <sys/types.h>
+#include <ApplicationServices/ApplicationServices.h>
+
+/* Subscribe to application launch, termination and activation
+ * launched: called on the main run loop with the new app's pid
+ * terminated: called on the main run loop with the exited app's pid
+ * activated: called on the main run loop with the new frontmost app's pid
+ */
+void workspace_init(void (*launched)(pid_t), void (*terminated)(pid_t),
+                    void (*activated)(pid_t));
+
+/* Look up the localized name and bundle id of a running app
+ * Returns 0 if no app with that pid is known, strings may be left empty
+ */
+int workspace_appinfo(pid_t pid, char *name, size_t namesz, char *bundle, size_t bundlesz);
+
+/* Launch or activate an app bundle through LaunchServices
+ * args: NULL terminated arguments for a fresh launch, may be NULL
+ * Returns 0 if there is no bundle at path, launch errors are logged
+ */
+int workspace_launch(const char *path, const char *const *args);
+
+/* Usable area of a display in global top-left coordinates,
+ * i.e. NSScreen visibleFrame without the menu bar and Dock
+ * Returns 0 if AppKit does not know the display
+ */
+int workspace_usablerect(CGDirectDisplayID display, CGRect *rect);
+
+/* Remove the notification observers */
+void workspace_cleanup(void);
+
+#endif /* WORKSPACE_H */
@@ -0,0 +1,141 @@
+/* mwm workspace - NSWorkspace and NSScreen integration
+ *
+ * Forwards NSWorkspace launch/terminate/activate notifications to mwm
+ * as plain pid callbacks, launches app bundles and answers app
+ * name/bundle id and usable screen area lookups, so the C side never
+ * touches Cocoa.
+ */
+
+#import <Cocoa/Cocoa.h>
+#include "workspace.h"
+
+static id launchObserver = nil;
+static id terminateObserver = nil;
+static id activateObserver = nil;
+
+static pid_t notificationpid(NSNotification *note) {
+    NSRunningApplication *app = note.userInfo[NSWorkspaceApplicationKey];
+    return app ? app.processIdentifier : -1;
+}
+
+void workspace_init(void (*launched)(pid_t), void (*terminated)(pid_t),
+                    void (*activated)(pid_t)) {
+    @autoreleasepool {
+        NSNotificationCenter *nc = [[NSWorkspace sharedWorkspace] notificationCenter];
+        NSOperationQueue *main = [NSOperationQueue mainQueue];
+
+        launchObserver = [nc addObserverForName:NSWorkspaceDidLaunchApplicationNotification
+                                         object:nil
+                                          queue:main
+                                     usingBlock:^(NSNotification *note) {
+            pid_t pid = notificationpid(note);
+            if (pid > 0 && launched)
+                launched(pid);
+        }];
+        [launchObserver retain];
+
+        terminateObserver = [nc addObserverForName:NSWorkspaceDidTerminateApplicationNotification
+                                            object:nil
+                                             queue:main
+                                        usingBlock:^(NSNotification *note) {
+            pid_t pid = notificationpid(note);
+            if (pid > 0 && terminated)
+                terminated(pid);
+        }];
+        [terminateObserver retain];
+
+        activateObserver = [nc addObserverForName:NSWorkspaceDidActivateApplicationNotification
+                                           object:nil
+                                            queue:main
+                                       usingBlock:^(NSNotification *note) {
+            pid_t pid = notificationpid(note);
+            if (pid > 0 && activated)
+                activated(pid);
+        }];
+        [activateObserver retain];
+    }
+}
+
+int workspace_appinfo(pid_t pid, char *name, size_t namesz, char *bundle, size_t bundlesz) {
+    @autoreleasepool {
+        NSRunningApplication *app = [NSRunningApplication runningApplicationWithProcessIdentifier:pid];
+        if (!app)
+            return 0;
+
+        snprintf(name, namesz, "%s", app.localizedName ? app.localizedName.UTF8String : "");
+        snprintf(bundle, bundlesz, "%s", app.bundleIdentifier ? app.bundleIdentifier.UTF8String : "");
+        return 1;
+    }
+}
+
+int workspace_launch(const char *path, const char *const *args) {
+    @autoreleasepool {
+        NSString *p = [NSString stringWithUTF8String:path];
+        NSWorkspaceOpenConfiguration *config = [NSWorkspaceOpenConfiguration configuration];
+        NSMutableArray<NSString *> *arguments = [NSMutableArray array];
+
+        if (!p || ![[NSFileManager defaultManager] fileExistsAtPath:p])
+            return 0;
+
+        for (; args && *args; args++)
+            [arguments addObject:[NSString stringWithUTF8String:*args]];
+        config.arguments = arguments;
+        config.activates = YES;
+
+        /* asynchronous, the new windows arrive through the usual notifications */
+        [[NSWorkspace sharedWorkspace] openApplicationAtURL:[NSURL fileURLWithPath:p]
+                                              configuration:config
+                                          completionHandler:^(NSRunningApplication *app, NSError *error) {
+            if (error)
+                fprintf(stderr, "mwm: cannot open %s: %s\n", p.UTF8String,
+                        error.localizedDescription.UTF8String);
+        }];
+        return 1;
+    }
+}
+
+int workspace_usablerect(CGDirectDisplayID display, CGRect *rect) {
+    @autoreleasepool {
+        NSArray<NSScreen *> *screens = [NSScreen screens];
+        if (screens.count == 0)
+            return 0;
+
+        /* Cocoa is bottom-left based on the primary screen, CG top-left */
+        CGFloat primaryheight = screens[0].frame.size.height;
+
+        for (NSScreen *screen in screens) {
+            NSNumber *num = screen.deviceDescription[@"NSScreenNumber"];
+            if (!num || num.unsignedIntValue != display)
+                continue;
+
+            NSRect vf = screen.visibleFrame;
+            *rect = CGRectMake(vf.origin.x,
+                               primaryheight - (vf.origin.y + vf.size.height),
+                               vf.size.width, vf.size.height);
+            return 1;
+        }
+        return 0;
+    }
+}
+
+void workspace_cleanup(void) {
+    @autoreleasepool {
+        NSNotificationCenter *nc = [[NSWorkspace sharedWorkspace] notificationCenter];
+
+        if (launchObserver) {
+            [nc removeObserver:launchObserver];
+            [launchObserver release];
+            launchObserver = nil;
+        }
+        if (terminateObserver) {
+            [nc removeObserver:terminateObserver];
+            [terminateObserver release];
+            terminateObserver = nil;
+        }
+        if (activateObserver) {
+            [nc removeObserver:activateObserver];
+            [activateObserver release];
+            activateObserver = nil;
+        }
+    }
+}